@@ -20,6 +20,7 @@ struct token {
 	/* whether or not the token was preceeded by a space */
 	bool space;
 	struct location loc;
+	/* for TEMBED, points to a struct stringlit with the embedded data */
 	char *lit;
 };
 
@@ -291,13 +292,69 @@ extern const char *tokstr[];
 void tokenprint(const struct token *);
 char *tokencheck(const struct token *, enum tokenkind, const char *);
 noreturn void error(const struct location *, const char *, ...);
+void warning(const struct location *, const char *, ...);
 
 /* scan */
 
 void scanfrom(const char *, FILE *);
+void scantext(const char *, char *);
 void scanopen(void);
 void scansetloc(struct location loc);
+const char *scanname(void);
+size_t scandepth(void);
 void scan(struct token *);
+bool scanskip(bool);
+char *scanheadername(struct location *);
+char *scanline(void);
+
+/* sys */
+
+struct fileinfo {
+	/* whether dev and ino identify the file, which is not possible on all hosts */
+	bool hasid;
+	unsigned long long dev, ino;
+	/* used to check whether a file has changed, or 0 if unknown */
+	unsigned long long mtime, mtimensec, size;
+};
+
+void fileinfo(FILE *, const char *, struct fileinfo *);
+bool pathinfo(const char *, struct fileinfo *);
+char *fullpath(const char *);
+
+/* pch */
+
+struct pchwriter {
+	/* target and files the header depends on, followed by the string table */
+	struct array head;
+	/* string table, and the index of each string plus one */
+	struct array strs;
+	struct map index;
+	/* macros, declarations, and IL, which refer to the string table */
+	struct array body;
+	/* file of the last token written */
+	const char *file;
+};
+
+struct pchreader {
+	const char *name;
+	unsigned char *pos, *end;
+	char **strs;
+	size_t nstrs;
+	/* file of the last token read */
+	const char *file;
+};
+
+void pchputint(struct array *, unsigned long long);
+void pchputstr(struct array *, const char *);
+void pchputref(struct pchwriter *, const char *);
+noreturn void pchcorrupt(struct pchreader *);
+unsigned long long pchgetint(struct pchreader *);
+size_t pchgetcount(struct pchreader *);
+char *pchgetstr(struct pchreader *);
+char *pchgetref(struct pchreader *);
+
+void pchwrite(const char *);
+void pchread(const char *, bool);
 
 /* preprocessor */
 
@@ -308,7 +365,21 @@ enum ppflags {
 
 extern enum ppflags ppflags;
 
+enum ppdir {
+	PPDIRQUOTE,    /* -iquote */
+	PPDIRINCLUDE,  /* -I */
+	PPDIRSYSTEM,   /* -isystem */
+	PPDIRAFTER,    /* -idirafter */
+};
+
 void ppinit(void);
+void ppadddir(enum ppdir, char *);
+void ppdefine(const char *);
+void ppundef(const char *);
+void expandembed(void);
+void ppwritepch(struct pchwriter *, const char *);
+void ppreaddeps(struct pchreader *);
+void ppreadmacros(struct pchreader *);
 
 void next(void);
 bool peek(enum tokenkind);
@@ -351,6 +422,8 @@ struct target {
 	struct type *typevalist;
 	struct type *typewchar;
 	int signedchar;
+	/* predefined macros, in the form of -D options */
+	const char *const *macros;
 };
 
 extern const struct target *targ;
@@ -379,12 +452,23 @@ bool gnuattr(struct attr *, enum attrkind);
 
 /* decl */
 
+/* declarations and types live until the end of the translation unit */
+extern struct arena permarena;
+/* expressions and initializers are released after each top-level declaration */
+extern struct arena tmparena;
+extern struct arena *exprarena;
+
 struct decl *mkdecl(char *name, enum declkind, struct type *, enum typequal, enum linkage);
 bool decl(struct scope *, struct func *);
 struct type *typename(struct scope *, enum typequal *, struct expr **);
 
+/* static objects for string literals, keyed by their contents */
+extern struct map stringdecls;
 struct decl *stringdecl(struct expr *);
 
+/* objects with a tentative definition, chained through next */
+extern struct decl *tentativedefns;
+void tentativedefn(struct decl *);
 void emittentativedefns(void);
 
 /* scope */
@@ -403,13 +487,15 @@ extern struct scope filescope;
 
 /* expr */
 
+unsigned long long charconstval(const struct token *, struct type **);
 struct type *stringconcat(struct stringlit *, bool);
+int precedence(enum tokenkind);
+struct expr *embedexpr(struct type *);
 
 struct expr *expr(struct scope *);
 struct expr *assignexpr(struct scope *);
 struct expr *condexpr(struct scope *);
 unsigned long long intconstexpr(struct scope *, bool);
-void delexpr(struct expr *);
 
 struct expr *exprassign(struct expr *, struct type *);
 struct expr *exprpromote(struct expr *);
@@ -429,6 +515,15 @@ void stmt(struct func *, struct scope *);
 
 /* backend */
 
+enum optflags {
+	/* promote scalar local variables to temporaries */
+	OPTPROMOTE = 1 << 0,
+	/* remove unreachable and empty blocks, and merge straight-line blocks */
+	OPTSIMPLIFY = 1 << 1,
+};
+
+extern enum optflags optflags;
+
 struct gotolabel {
 	struct block *label;
 	bool defined;
@@ -464,3 +559,9 @@ void funcinit(struct func *, struct decl *, struct init *, bool);
 
 void emitfunc(struct func *, bool);
 void emitdata(struct decl *,  struct init *);
+void emitflush(void);
+void emitcapture(void);
+void emitwritepch(struct pchwriter *);
+void emitreadpch(struct pchreader *);
+void pchputvalue(struct pchwriter *, struct value *);
+struct value *pchgetvalue(struct pchreader *);
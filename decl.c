@@ -8,7 +8,9 @@
 #include "util.h"
 #include "cc.h"
 
-static struct decl *tentativedefns, **tentativedefnsend = &tentativedefns;
+struct decl *tentativedefns;
+static struct decl **tentativedefnsend = &tentativedefns;
+struct map stringdecls;
 
 struct qualtype {
 	struct type *type;
@@ -61,12 +63,15 @@ struct structbuilder {
 	bool pack;
 };
 
+struct arena permarena, tmparena;
+struct arena *exprarena = &tmparena;
+
 struct decl *
 mkdecl(char *name, enum declkind k, struct type *t, enum typequal tq, enum linkage linkage)
 {
 	struct decl *d;
 
-	d = xmalloc(sizeof(*d));
+	d = arenaalloc(&permarena, sizeof(*d));
 	memset(d, 0, sizeof(*d));
 	d->name = name;
 	d->kind = k;
@@ -561,6 +566,7 @@ declaratortypes(struct scope *s, struct list *result, char **name, struct scope
 	struct type *t;
 	struct decl *d, **paramend;
 	struct expr *e;
+	struct arena *arena;
 	enum typequal tq;
 	bool allowattr;
 
@@ -661,7 +667,11 @@ declaratortypes(struct scope *s, struct list *result, char **name, struct scope
 				t->prop |= PROPVM;
 				t->incomplete = false;
 			} else if (!consume(TRBRACK)) {
+				/* the length expression lives as long as the type */
+				arena = exprarena;
+				exprarena = &permarena;
 				e = assignexpr(s);
+				exprarena = arena;
 				if (!(e->type->prop & PROPINT))
 					error(&tok.loc, "array length expression must have integer type");
 				t->u.array.length = e;
@@ -795,7 +805,7 @@ addmember(struct structbuilder *b, struct qualtype mt, char *name, int align, un
 		error(&tok.loc, "struct member '%s' has variably modified type", name);
 	assert(mt.type->align > 0);
 	if (name || width == -1) {
-		m = xmalloc(sizeof(*m));
+		m = arenaalloc(&permarena, sizeof(*m));
 		m->type = mt.type;
 		m->qual = mt.qual;
 		m->name = name;
@@ -1112,8 +1122,7 @@ decl(struct scope *s, struct func *f)
 			} else if (d->linkage != LINKNONE && d->u.obj.storage == SDSTATIC) {
 				if (!d->defined && !d->tentative) {
 					d->tentative = true;
-					*tentativedefnsend = d;
-					tentativedefnsend = &d->next;
+					tentativedefn(d);
 				}
 				break;
 			}
@@ -1162,16 +1171,15 @@ decl(struct scope *s, struct func *f)
 struct decl *
 stringdecl(struct expr *expr)
 {
-	static struct map strings;
 	struct mapkey key;
 	void **entry;
 	struct decl *d;
 
-	if (!strings.len)
-		mapinit(&strings, 64);
+	if (!stringdecls.len)
+		mapinit(&stringdecls, 64);
 	assert(expr->kind == EXPRSTRING);
 	mapkey(&key, expr->u.string.data, expr->u.string.size);
-	entry = mapput(&strings, &key);
+	entry = mapput(&stringdecls, &key);
 	d = *entry;
 	if (!d) {
 		d = mkdecl("string", DECLOBJECT, expr->type, QUALNONE, LINKNONE);
@@ -1182,6 +1190,14 @@ stringdecl(struct expr *expr)
 	return d;
 }
 
+/* add an object to the list of those that are defined at the end if they have no definition */
+void
+tentativedefn(struct decl *d)
+{
+	*tentativedefnsend = d;
+	tentativedefnsend = &d->next;
+}
+
 void
 emittentativedefns(void)
 {
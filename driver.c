@@ -1,4 +1,14 @@
 #define _POSIX_C_SOURCE 200809L
+#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+/* wait4, for the resource usage of each process with -ftime-report */
+#define HAVE_WAIT4 1
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#endif
+#ifdef __linux__
+/* memfd_create */
+#define _GNU_SOURCE
+#endif
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -9,9 +19,16 @@
 
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <spawn.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "util.h"
@@ -41,7 +58,12 @@ struct stageinfo {
 	const char *name;
 	struct array cmd;
 	size_t cmdbase;
-	pid_t pid;
+	/* resource usage totals for -ftime-report */
+	struct {
+		size_t count;
+		double wall, user, sys;
+		long maxrss;
+	} stats;
 };
 
 struct input {
@@ -49,12 +71,61 @@ struct input {
 	unsigned stages;
 	enum filetype filetype;
 	bool lib;
+	/* whether the input is an intermediate object to be removed on exit */
+	bool temp;
+};
+
+struct job {
+	struct input *input;
+	const char *source;
+	char *output;
+	pid_t pid[LINK];
+	struct timespec start[LINK];
+	size_t npids;
+	bool success;
+	/* stages still to run once the current pipeline has finished */
+	unsigned stages;
+	/* preprocessed source and compile cache entry */
+	char *cppout, *cached;
+};
+
+struct hash {
+	unsigned long long hi, lo;
 };
 
 static struct {
+	bool memfd;
 	bool nostdlib;
 	bool verbose;
 } flags;
+static struct array inputs;
+static struct job *jobs;
+static size_t njobs, maxjobs;
+static bool failed;
+static struct {
+	bool enabled, report;
+	/* file to append JSON lines to, if any */
+	int logfd;
+} stats = {.logfd = -1};
+static struct {
+	char *dir;
+	/* whether objects are hard-linked instead of copied */
+	bool hardlink;
+	/* hash of everything but the preprocessed source */
+	struct hash key;
+} cache;
+static struct {
+	int rfd, wfd;
+	/* whether reads of rfd block, as with the pipe of make 4.3 and earlier */
+	bool blocking;
+	/* duplicate of a blocking rfd, closed by the SIGCHLD handler */
+	volatile sig_atomic_t dupfd;
+	/* tokens held for all but one of the running jobs */
+	char *tokens;
+	size_t ntokens;
+	/* written to by the SIGCHLD handler */
+	int sigfd[2];
+} jobserver = {.rfd = -1, .wfd = -1, .dupfd = -1};
 static struct stageinfo stages[] = {
 	[PREPROCESS] = {.name = "preprocess"},
 	[COMPILE]    = {.name = "compile"},
@@ -63,6 +134,17 @@ static struct stageinfo stages[] = {
 	[LINK]       = {.name = "link"},
 };
 
+/* with precompiled headers, C sources are preprocessed by cproc-qbe instead of the preprocessor */
+static struct {
+	bool emit;
+	char *include;
+	bool nostdinc;
+	/* preprocessor options that cproc-qbe understands */
+	struct array ppflags;
+	/* an option that only the preprocessor understands, to report if precompiled headers are used */
+	char *unsupported;
+} pch;
+
 static const char *const ignoreflags[] = {
 	"fno-builtin",
 	"pedantic",
@@ -82,7 +164,7 @@ usage(const char *fmt, ...)
 		va_end(ap);
 		fputc('\n', stderr);
 	}
-	fprintf(stderr, "usage: %s [-c|-S|-E] [-D name[=value]] [-U name] [-s] [-g] [-o output] input...\n", argv0);
+	fprintf(stderr, "usage: %s [-c|-S|-E] [-D name[=value]] [-U name] [-s] [-g] [-j jobs] [-o output] input...\n", argv0);
 	exit(2);
 }
 
@@ -146,8 +228,15 @@ spawn(pid_t *pid, struct array *args, posix_spawn_file_actions_t *actions)
 	return posix_spawnp(pid, *(char **)args->val, actions, NULL, args->val, environ);
 }
 
+/*
+spawn a phase of the pipeline, reading from *fd if it is open
+
+If this is the last phase, it writes to output, or to outfd if
+output is NULL and outfd is open. Otherwise, *fd is set to the read
+end of a pipe connected to its standard output.
+*/
 static int
-spawnphase(struct stageinfo *phase, int *fd, char *input, char *output, bool last)
+spawnphase(struct stageinfo *phase, pid_t *pid, int *fd, char *input, char *output, int outfd, bool last)
 {
 	int ret, pipefd[2];
 	posix_spawn_file_actions_t actions;
@@ -165,6 +254,8 @@ spawnphase(struct stageinfo *phase, int *fd, char *input, char *output, bool las
 		goto err0;
 	if (*fd != -1)
 		ret = posix_spawn_file_actions_adddup2(&actions, *fd, 0);
+	if (last && !output && outfd != -1)
+		ret = posix_spawn_file_actions_adddup2(&actions, outfd, 1);
 	if (!last) {
 		if (pipe(pipefd) < 0) {
 			ret = errno;
@@ -183,9 +274,13 @@ spawnphase(struct stageinfo *phase, int *fd, char *input, char *output, bool las
 			goto err2;
 	}
 
-	ret = spawn(&phase->pid, &phase->cmd, &actions);
+	ret = spawn(pid, &phase->cmd, &actions);
 	if (ret)
 		goto err2;
+	if (*fd != -1) {
+		close(*fd);
+		*fd = -1;
+	}
 	if (!last) {
 		*fd = pipefd[0];
 		close(pipefd[1]);
@@ -221,25 +316,681 @@ succeeded(const char *phase, pid_t pid, int status)
 }
 
 static void
-buildobj(struct input *input, char *output)
+statsinit(void)
+{
+	const char *path;
+
+	path = getenv("CPROC_STATS");
+	if (path && path[0]) {
+		stats.logfd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+		if (stats.logfd < 0)
+			fatal("open %s:", path);
+	}
+	stats.enabled = stats.report || stats.logfd != -1;
+}
+
+static void
+jsonstring(struct array *buf, const char *str)
 {
-	const char *phase;
-	size_t i, npids;
+	char esc[8];
+
+	arrayaddbuf(buf, "\"", 1);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			esc[0] = '\\';
+			esc[1] = *str;
+			arrayaddbuf(buf, esc, 2);
+		} else if ((unsigned char)*str < 0x20) {
+			sprintf(esc, "\\u%04x", *str);
+			arrayaddbuf(buf, esc, 6);
+		} else {
+			arrayaddbuf(buf, str, 1);
+		}
+	}
+	arrayaddbuf(buf, "\"", 1);
+}
+
+static void
+recordstats(struct stageinfo *s, const char *input, struct timespec *start, pid_t pid, int status, struct rusage *ru)
+{
+	static struct array buf;
+	struct timespec now;
+	double wall, user, sys;
+	long maxrss;
+	char line[256];
+	int len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wall = now.tv_sec - start->tv_sec + (now.tv_nsec - start->tv_nsec) / 1e9;
+	user = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+	sys = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+	maxrss = ru->ru_maxrss;
+#ifdef __APPLE__
+	maxrss /= 1024;  /* reported in bytes rather than kilobytes */
+#endif
+	++s->stats.count;
+	s->stats.wall += wall;
+	s->stats.user += user;
+	s->stats.sys += sys;
+	if (maxrss > s->stats.maxrss)
+		s->stats.maxrss = maxrss;
+	if (stats.logfd == -1)
+		return;
+	/* write each line at once, since other processes may be appending too */
+	buf.len = 0;
+	arrayaddbuf(&buf, "{\"input\":", 9);
+	jsonstring(&buf, input);
+	len = snprintf(line, sizeof(line), ",\"stage\":\"%s\",\"pid\":%ju,\"status\":%d,\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss\":%ld}\n", s->name, (uintmax_t)pid, status, wall, user, sys, maxrss);
+	arrayaddbuf(&buf, line, len);
+	if (write(stats.logfd, buf.val, buf.len) < 0)
+		warn("write stats:");
+}
+
+static void
+printstats(void)
+{
+	struct stageinfo *s;
+	double user = 0, sys = 0;
+
+	fprintf(stderr, "%-10s %6s %10s %10s %10s %12s\n", "stage", "procs", "wall (s)", "user (s)", "sys (s)", "maxrss (KiB)");
+	for (s = stages; s != stages + countof(stages); ++s) {
+		if (s->stats.count == 0)
+			continue;
+		fprintf(stderr, "%-10s %6zu %10.3f %10.3f %10.3f %12ld\n", s->name, s->stats.count, s->stats.wall, s->stats.user, s->stats.sys, s->stats.maxrss);
+		user += s->stats.user;
+		sys += s->stats.sys;
+	}
+	fprintf(stderr, "%-10s %6s %10s %10.3f %10.3f\n", "total", "", "", user, sys);
+}
+
+static void
+hashinit(struct hash *h)
+{
+	/* 128-bit FNV-1a */
+	h->hi = 0x6c62272e07bb0142;
+	h->lo = 0x62b821756295c58d;
+}
+
+static void
+hashupdate(struct hash *h, const void *buf, size_t len)
+{
+	const unsigned char *pos, *end;
+	unsigned long long hi, lo, a, b;
+
+	hi = h->hi;
+	lo = h->lo;
+	for (pos = buf, end = pos + len; pos != end; ++pos) {
+		lo ^= *pos;
+		/* multiply by the FNV prime, 2^88 + 0x13b */
+		a = (lo & 0xffffffff) * 0x13b;
+		b = (lo >> 32) * 0x13b;
+		hi = hi * 0x13b + (b >> 32) + (lo << 24);
+		lo = a + (b << 32);
+		hi += lo < a;
+	}
+	h->hi = hi;
+	h->lo = lo;
+}
+
+static bool
+copyfile(const char *src, const char *dst)
+{
+	char buf[16384], *pos;
+	ssize_t n, m;
+	int in, out;
+	bool ok = false;
+
+	in = open(src, O_RDONLY);
+	if (in < 0)
+		return false;
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0) {
+		close(in);
+		return false;
+	}
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		for (pos = buf; n > 0; pos += m, n -= m) {
+			m = write(out, pos, n);
+			if (m < 0)
+				goto done;
+		}
+	}
+	ok = n == 0;
+done:
+	close(in);
+	if (close(out) != 0)
+		ok = false;
+	return ok;
+}
+
+/* find the file that posix_spawnp runs for a command */
+static bool
+findcommand(const char *name, struct stat *st)
+{
+	const char *path;
+	char *buf;
+	size_t len;
+	bool found;
+
+	if (strchr(name, '/'))
+		return stat(name, st) == 0;
+	path = getenv("PATH");
+	if (!path)
+		path = "/bin:/usr/bin";
+	buf = xmalloc(strlen(path) + strlen(name) + 3);
+	found = false;
+	for (;;) {
+		len = strcspn(path, ":");
+		/* an empty entry is the working directory */
+		if (len > 0)
+			sprintf(buf, "%.*s/%s", (int)len, path, name);
+		else
+			sprintf(buf, "./%s", name);
+		if (stat(buf, st) == 0 && S_ISREG(st->st_mode) && access(buf, X_OK) == 0) {
+			found = true;
+			break;
+		}
+		if (!path[len])
+			break;
+		path += len + 1;
+	}
+	free(buf);
+	return found;
+}
+
+static void
+cacheinit(void)
+{
+	static const enum stage keystages[] = {COMPILE, CODEGEN, ASSEMBLE};
+	struct stageinfo *s;
+	struct stat st;
+	unsigned long long id[4];
+	const char *hardlink;
+	size_t i, nargs;
+	char **arg;
+
+	cache.dir = getenv("CPROC_CACHE_DIR");
+	if (!cache.dir || !cache.dir[0]) {
+		cache.dir = NULL;
+		return;
+	}
+	hardlink = getenv("CPROC_CACHE_HARDLINK");
+	cache.hardlink = hardlink && hardlink[0];
+	hashinit(&cache.key);
+	hashupdate(&cache.key, target, sizeof(target));
+	for (i = 0; i < countof(keystages); ++i) {
+		s = &stages[keystages[i]];
+		/* identify the program by its inode, size, and modification time */
+		if (!findcommand(*(char **)s->cmd.val, &st)) {
+			warn("cache: %s not found, not using the cache", *(char **)s->cmd.val);
+			cache.dir = NULL;
+			return;
+		}
+		id[0] = st.st_dev;
+		id[1] = st.st_ino;
+		id[2] = st.st_size;
+		id[3] = st.st_mtime;
+		hashupdate(&cache.key, id, sizeof(id));
+		nargs = s->cmdbase / sizeof(char *);
+		hashupdate(&cache.key, &nargs, sizeof(nargs));
+		for (arg = s->cmd.val; nargs > 0; --nargs, ++arg)
+			hashupdate(&cache.key, *arg, strlen(*arg) + 1);
+	}
+	if (mkdir(cache.dir, 0777) < 0 && errno != EEXIST)
+		fatal("mkdir %s:", cache.dir);
+}
+
+static char *
+cachetemp(int *fd)
+{
+	char *path;
+
+	path = xmalloc(strlen(cache.dir) + 12);
+	sprintf(path, "%s/tmp.XXXXXX", cache.dir);
+	*fd = mkstemp(path);
+	if (*fd < 0)
+		fatal("mkstemp:");
+	return path;
+}
+
+/*
+hash the preprocessed source of a job, and if it is in the cache,
+copy (or hard-link, if enabled) the cached object to the job's output
+
+Objects are copied by default, since a tool that modifies the output
+in place would otherwise modify the cached object for every source
+that shares it.
+*/
+static bool
+cachelookup(struct job *job)
+{
+	struct hash h;
+	char buf[16384];
+	ssize_t n;
+	int fd;
+
+	fd = open(job->cppout, O_RDONLY);
+	if (fd < 0) {
+		warn("open %s:", job->cppout);
+		return false;
+	}
+	h = cache.key;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		hashupdate(&h, buf, n);
+	close(fd);
+	if (n < 0) {
+		warn("read %s:", job->cppout);
+		return false;
+	}
+	job->cached = xmalloc(strlen(cache.dir) + 36);
+	sprintf(job->cached, "%s/%016llx%016llx.o", cache.dir, h.hi, h.lo);
+	if (access(job->cached, F_OK) != 0)
+		return false;
+	unlink(job->output);
+	if (cache.hardlink && link(job->cached, job->output) == 0) {
+		/* make sure the output is newer than its sources */
+		utimensat(AT_FDCWD, job->output, NULL, 0);
+	} else if (!copyfile(job->cached, job->output)) {
+		return false;
+	}
+	if (flags.verbose)
+		fprintf(stderr, "%s: using cached %s\n", argv0, job->cached);
+	return true;
+}
+
+static void
+cachestore(struct job *job)
+{
+	struct stat st;
+	char *tmp;
+	int fd;
+
+	if (cache.hardlink) {
+		if (link(job->output, job->cached) == 0 || errno == EEXIST)
+			return;
+	} else if (access(job->cached, F_OK) == 0) {
+		return;
+	}
+	tmp = cachetemp(&fd);
+	close(fd);
+	if (stat(job->output, &st) < 0 || !copyfile(job->output, tmp) || chmod(tmp, st.st_mode & 0777) < 0 || rename(tmp, job->cached) < 0) {
+		warn("cache: store %s:", job->cached);
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+static void
+killjob(struct job *job)
+{
+	size_t i;
+
+	if (job->success) {
+		for (i = 0; i < countof(job->pid); ++i) {
+			if (job->pid[i])
+				kill(job->pid[i], SIGTERM);
+		}
+	}
+	job->success = false;
+}
+
+static void
+sigchld(int sig)
+{
+	int err;
+
+	err = errno;
+	/* interrupt a blocked read of the jobserver pipe */
+	if (jobserver.dupfd != -1) {
+		close(jobserver.dupfd);
+		jobserver.dupfd = -1;
+	}
+	write(jobserver.sigfd[1], "", 1);
+	errno = err;
+}
+
+/* return the tokens not needed by n running jobs to the jobserver */
+static void
+puttokens(size_t n)
+{
+	char c;
+
+	while (jobserver.ntokens > 0 && jobserver.ntokens >= n) {
+		c = jobserver.tokens[--jobserver.ntokens];
+		while (write(jobserver.wfd, &c, 1) < 0) {
+			if (errno != EINTR) {
+				warn("jobserver: write:");
+				break;
+			}
+		}
+	}
+}
+
+/* return all held tokens on exit, including after a fatal error */
+static void
+jobserverexit(void)
+{
+	puttokens(0);
+}
+
+static void
+jobserverinit(void)
+{
+	static const char *const opts[] = {"--jobserver-auth=", "--jobserver-fds="};
+	struct sigaction sa = {.sa_handler = sigchld, .sa_flags = SA_RESTART};
+	const char *makeflags, *pos, *val;
+	char *path, *end;
+	size_t i, len;
+	long rfd, wfd;
+
+	makeflags = getenv("MAKEFLAGS");
+	if (!makeflags)
+		return;
+	/* the last occurrence takes precedence */
+	val = NULL;
+	for (i = 0; i < countof(opts); ++i) {
+		for (pos = makeflags; (pos = strstr(pos, opts[i])); ) {
+			pos += strlen(opts[i]);
+			val = pos;
+		}
+		if (val)
+			break;
+	}
+	if (!val)
+		return;
+	len = strcspn(val, " ");
+	if (strncmp(val, "fifo:", 5) == 0) {
+		path = xmalloc(len - 4);
+		memcpy(path, val + 5, len - 5);
+		path[len - 5] = '\0';
+		jobserver.rfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (jobserver.rfd < 0) {
+			warn("jobserver: open %s:", path);
+			free(path);
+			return;
+		}
+		jobserver.wfd = open(path, O_WRONLY | O_CLOEXEC);
+		if (jobserver.wfd < 0) {
+			warn("jobserver: open %s:", path);
+			close(jobserver.rfd);
+			jobserver.rfd = -1;
+			free(path);
+			return;
+		}
+		free(path);
+	} else {
+		rfd = strtol(val, &end, 10);
+		if (end == val || *end != ',')
+			return;
+		val = end + 1;
+		wfd = strtol(val, &end, 10);
+		if (end == val || *end && *end != ' ')
+			return;
+		/* make may not have passed the descriptors on to us */
+		if (rfd < 0 || wfd < 0 || fcntl(rfd, F_GETFD) < 0 || fcntl(wfd, F_GETFD) < 0)
+			return;
+		jobserver.rfd = rfd;
+		jobserver.wfd = wfd;
+		jobserver.blocking = !(fcntl(rfd, F_GETFL) & O_NONBLOCK);
+	}
+	if (pipe(jobserver.sigfd) < 0)
+		fatal("pipe:");
+	for (i = 0; i < 2; ++i) {
+		if (fcntl(jobserver.sigfd[i], F_SETFD, FD_CLOEXEC) < 0)
+			fatal("fcntl:");
+		if (fcntl(jobserver.sigfd[i], F_SETFL, O_NONBLOCK) < 0)
+			fatal("fcntl:");
+	}
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGCHLD, &sa, NULL) < 0)
+		fatal("sigaction:");
+	atexit(jobserverexit);
+}
+
+/*
+try to acquire a token
+
+A blocking pipe is read through a duplicate that the SIGCHLD handler
+closes, as GNU make does. Another client may take the token between
+poll and read, and the read would then block while our finished jobs
+go unreaped and their tokens unreturned. With the duplicate, the read
+fails with EBADF as soon as a job finishes.
+*/
+static bool
+gettoken(void)
+{
+	char c;
+
+	if (read(jobserver.blocking ? jobserver.dupfd : jobserver.rfd, &c, 1) != 1)
+		return false;
+	jobserver.tokens[jobserver.ntokens++] = c;
+	return true;
+}
+
+static void
+spawnpipeline(struct job *job, unsigned mask, char *input, char *output, int outfd)
+{
+	size_t i;
+	int ret, fd;
+
+	for (i = PREPROCESS, fd = -1; mask; ++i) {
+		if (!(mask & 1<<i))
+			continue;
+		mask &= ~(1<<i);
+		ret = spawnphase(&stages[i], &job->pid[i], &fd, input, output, outfd, !mask);
+		if (stats.enabled)
+			clock_gettime(CLOCK_MONOTONIC, &job->start[i]);
+		if (ret) {
+			warn("%s: spawn \"%s\": %s", stages[i].name, *(char **)stages[i].cmd.val, strerror(ret));
+			if (fd != -1)
+				close(fd);
+			killjob(job);
+			break;
+		}
+		++job->npids;
+	}
+}
+
+static void
+finishjob(struct job *job)
+{
+	if (job->success && job->stages) {
+		/* the source has been preprocessed, now check the cache */
+		if (!cachelookup(job)) {
+			spawnpipeline(job, job->stages, job->cppout, job->output, -1);
+			job->stages = 0;
+			if (job->npids > 0)
+				return;
+		}
+	} else if (job->success && job->cached) {
+		cachestore(job);
+	}
+	if (job->cppout) {
+		unlink(job->cppout);
+		free(job->cppout);
+	}
+	free(job->cached);
+	if (!job->success) {
+		/* intermediate objects are removed on exit */
+		if (job->output && !job->input->temp)
+			unlink(job->output);
+		failed = true;
+	}
+	*job = jobs[--njobs];
+	if (jobserver.rfd != -1)
+		puttokens(njobs);
+}
+
+/*
+wait for a child process, and get its resource usage if statistics are
+enabled
+
+wait4 is not in POSIX, so where it is missing, the usage is the change
+in the totals for reaped children. The peak RSS is then the largest of
+any child so far.
+*/
+static pid_t
+waitchild(pid_t pid, int *status, int options, struct rusage *ru)
+{
+#ifdef HAVE_WAIT4
+	if (stats.enabled)
+		return wait4(pid, status, options, ru);
+	return waitpid(pid, status, options);
+#else
+	struct rusage old;
+
+	if (!stats.enabled)
+		return waitpid(pid, status, options);
+	getrusage(RUSAGE_CHILDREN, &old);
+	pid = waitpid(pid, status, options);
+	if (pid > 0) {
+		getrusage(RUSAGE_CHILDREN, ru);
+		ru->ru_utime.tv_sec -= old.ru_utime.tv_sec;
+		ru->ru_utime.tv_usec -= old.ru_utime.tv_usec;
+		ru->ru_stime.tv_sec -= old.ru_stime.tv_sec;
+		ru->ru_stime.tv_usec -= old.ru_stime.tv_usec;
+	}
+	return pid;
+#endif
+}
+
+/*
+wait for a child process, and finish its job if it was the last stage
+
+Returns false if there was no process to reap.
+*/
+static bool
+reap(int options)
+{
+	struct job *job;
+	struct rusage ru;
+	size_t i;
 	pid_t pid;
-	int status, ret, fd;
-	bool success = true;
+	int status;
+
+	pid = waitchild(-1, &status, options, &ru);
+	if (pid < 0)
+		fatal("wait:");
+	if (pid == 0)
+		return false;
+	for (job = jobs; job != jobs + njobs; ++job) {
+		for (i = 0; i < countof(job->pid); ++i) {
+			if (job->pid[i] == pid)
+				goto found;
+		}
+	}
+	return true;  /* unknown process */
+found:
+	job->pid[i] = 0;
+	--job->npids;
+	if (stats.enabled)
+		recordstats(&stages[i], job->source, &job->start[i], pid, status, &ru);
+	if (!succeeded(stages[i].name, pid, status))
+		killjob(job);
+	if (job->npids == 0)
+		finishjob(job);
+	return true;
+}
 
-	if (input->filetype == OBJ)
+static void
+waitjobs(size_t n)
+{
+	while (njobs > n)
+		reap(0);
+}
+
+/* wait until another job may be started */
+static void
+waitslot(void)
+{
+	struct pollfd pfd[2];
+	char buf[64];
+
+	waitjobs(maxjobs - 1);
+	if (jobserver.rfd == -1)
 		return;
+	/* the first job runs on our own implicit token */
+	pfd[0].fd = jobserver.rfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = jobserver.sigfd[0];
+	pfd[1].events = POLLIN;
+	for (;;) {
+		/* duplicate before reaping, so a job finishing after that closes it */
+		if (jobserver.blocking && jobserver.dupfd == -1) {
+			jobserver.dupfd = fcntl(jobserver.rfd, F_DUPFD_CLOEXEC, 0);
+			if (jobserver.dupfd == -1)
+				fatal("jobserver: dup:");
+		}
+		while (read(jobserver.sigfd[0], buf, sizeof(buf)) > 0)
+			;
+		while (njobs > 0 && reap(WNOHANG))
+			;
+		if (njobs == 0 || gettoken())
+			break;
+		if (!jobserver.blocking && poll(pfd, 2, -1) < 0 && errno != EINTR)
+			fatal("poll:");
+	}
+}
+
+static void
+removetemps(void)
+{
+	struct input *input;
+
+	arrayforeach (&inputs, input) {
+		if (input->temp && !flags.memfd)
+			unlink(input->name);
+		input->temp = false;
+	}
+}
+
+/* create an intermediate object file which is only used for linking */
+static char *
+tempobj(void)
+{
+	static bool registered;
+	const char *dir;
+	char *path;
+	int fd;
+
+	if (!registered) {
+		/* also remove them when we exit due to a failure */
+		atexit(removetemps);
+		registered = true;
+	}
+#ifdef __linux__
+	if (flags.memfd) {
+		/* the descriptor must be inherited by the assembler and linker */
+		fd = memfd_create("cproc", 0);
+		if (fd < 0)
+			fatal("memfd_create:");
+		path = xmalloc(32);
+		snprintf(path, 32, "/proc/self/fd/%d", fd);
+		return path;
+	}
+#endif
+	dir = getenv("TMPDIR");
+	if (!dir || !dir[0])
+		dir = "/tmp";
+	path = xmalloc(strlen(dir) + 14);
+	sprintf(path, "%s/cproc-XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd < 0)
+		fatal("mkstemp:");
+	close(fd);
+	return path;
+}
+
+static void
+buildobj(struct input *input, char *output)
+{
+	struct job *job;
+	int fd;
+
 	if (input->stages & 1<<LINK) {
 		input->stages &= ~(1<<LINK);
-		output = strdup("/tmp/cproc-XXXXXX");
-		if (!output)
-			fatal("strdup:");
-		fd = mkstemp(output);
-		if (fd < 0)
-			fatal("mkstemp:");
-		close(fd);
+		output = tempobj();
+		input->temp = true;
 	} else if (output) {
 		if (strcmp(output, "-") == 0)
 			output = NULL;
@@ -248,61 +999,49 @@ buildobj(struct input *input, char *output)
 	} else if (input->stages & 1<<CODEGEN) {
 		output = changeext(input->name, "s");
 	} else if (input->stages & 1<<COMPILE) {
-		output = changeext(input->name, "qbe");
+		output = changeext(input->name, pch.emit ? "pch" : "qbe");
 	}
 	if (strcmp(input->name, "-") == 0)
 		input->name = NULL;
 
-	npids = 0;
-	for (i = PREPROCESS, fd = -1; input->stages; ++i) {
-		if (!(input->stages & 1<<i))
-			continue;
-		input->stages &= ~(1<<i);
-		ret = spawnphase(&stages[i], &fd, input->name, output, !input->stages);
-		if (ret) {
-			warn("%s: spawn \"%s\": %s", stages[i].name, *(char **)stages[i].cmd.val, strerror(ret));
-			goto kill;
-		}
-		++npids;
-	}
-	input->name = output;
-
-	while (npids > 0) {
-		pid = wait(&status);
-		if (pid < 0)
-			fatal("waitpid:");
-		for (i = 0; i < countof(stages); ++i) {
-			if (pid == stages[i].pid) {
-				--npids;
-				stages[i].pid = 0;
-				phase = stages[i].name;
-				break;
-			}
-		}
-		if (i == countof(stages))
-			continue;  /* unknown process */
-		if (!succeeded(phase, pid, status)) {
-kill:
-			if (success && npids > 0) {
-				for (i = 0; i < countof(stages); ++i) {
-					if (stages[i].pid)
-						kill(stages[i].pid, SIGTERM);
-				}
-			}
-			success = false;
-		}
+	if (!output) {
+		/* don't interleave output to stdout with any other job */
+		waitjobs(0);
+		if (failed)
+			return;
 	}
-	if (!success) {
-		if (output)
-			unlink(output);
-		exit(1);
+	job = &jobs[njobs++];
+	memset(job->pid, 0, sizeof(job->pid));
+	job->input = input;
+	job->source = input->name ? input->name : "-";
+	job->output = output;
+	job->npids = 0;
+	job->success = true;
+	job->stages = 0;
+	job->cppout = NULL;
+	job->cached = NULL;
+	if (cache.dir && (input->stages & (1<<PREPROCESS|1<<COMPILE|1<<ASSEMBLE)) == (1<<PREPROCESS|1<<COMPILE|1<<ASSEMBLE)) {
+		/* preprocess into a file first, so we can look it up in the cache */
+		job->cppout = cachetemp(&fd);
+		job->stages = input->stages & ~(1<<PREPROCESS);
+		spawnpipeline(job, 1<<PREPROCESS, input->name, NULL, fd);
+		close(fd);
+	} else {
+		spawnpipeline(job, input->stages, input->name, output, -1);
 	}
+	input->name = output;
+	if (job->npids == 0)
+		finishjob(job);
+	if (!output)
+		waitjobs(0);
 }
 
 static void
 buildexe(struct input *inputs, size_t ninputs, char *output)
 {
 	struct stageinfo *s = &stages[LINK];
+	struct timespec start;
+	struct rusage ru;
 	size_t i;
 	int ret, status;
 	pid_t pid;
@@ -321,14 +1060,15 @@ buildexe(struct input *inputs, size_t ninputs, char *output)
 	arrayaddptr(&s->cmd, NULL);
 
 	ret = spawn(&pid, &s->cmd, NULL);
+	if (stats.enabled)
+		clock_gettime(CLOCK_MONOTONIC, &start);
 	if (ret)
 		fatal("%s: spawn \"%s\": %s", s->name, *(char **)s->cmd.val, strerror(errno));
-	if (waitpid(pid, &status, 0) < 0)
+	if (waitchild(pid, &status, 0, &ru) < 0)
 		fatal("waitpid %ju:", (uintmax_t)pid);
-	for (i = 0; i < ninputs; ++i) {
-		if (inputs[i].filetype != OBJ)
-			unlink(inputs[i].name);
-	}
+	if (stats.enabled)
+		recordstats(s, output, &start, pid, status, &ru);
+	removetemps();
 	exit(!succeeded(s->name, pid, status));
 }
 
@@ -365,19 +1105,65 @@ compilecommand(char *arg)
 	return cmd;
 }
 
+static size_t
+cpucount(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return n;
+#endif
+	return 1;
+}
+
 static int
 hasprefix(const char *str, const char *pfx)
 {
 	return memcmp(str, pfx, strlen(pfx)) == 0;
 }
 
+/* pass the preprocessor options to cproc-qbe, which preprocesses C sources itself with precompiled headers */
+static void
+pchinit(enum stage last)
+{
+	struct array *cmd = &stages[COMPILE].cmd;
+	size_t i;
+
+	if (pch.unsupported)
+		usage("%s is not supported with precompiled headers", pch.unsupported);
+	if (last == PREPROCESS)
+		usage("-E is not supported with precompiled headers");
+	/* only the macro definitions of the configured preprocessor command apply to cproc-qbe */
+	for (i = 1; i + 1 < countof(preprocesscmd); ++i) {
+		if (strcmp(preprocesscmd[i], "-D") == 0 || strcmp(preprocesscmd[i], "-U") == 0) {
+			arrayaddptr(cmd, (char *)preprocesscmd[i]);
+			arrayaddptr(cmd, (char *)preprocesscmd[++i]);
+		}
+	}
+	arrayaddbuf(cmd, pch.ppflags.val, pch.ppflags.len);
+	if (!pch.nostdinc && includedirs[0]) {
+		for (i = 0; i < countof(includedirs); ++i) {
+			arrayaddptr(cmd, "-isystem");
+			arrayaddptr(cmd, (char *)includedirs[i]);
+		}
+	}
+	if (pch.emit)
+		arrayaddptr(cmd, "-emit-pch");
+	if (pch.include) {
+		arrayaddptr(cmd, "-include-pch");
+		arrayaddptr(cmd, pch.include);
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
 	enum stage last = LINK;
 	enum filetype filetype = 0;
 	char *arg, *end, *output = NULL, *arch, *qbearch;
-	struct array inputs = {0}, *cmd;
+	struct array *cmd;
 	struct input *input;
 	size_t i;
 
@@ -419,6 +1205,7 @@ ignore:
 			input = arrayadd(&inputs, sizeof(*input));
 			input->name = arg;
 			input->lib = false;
+			input->temp = false;
 			input->filetype = filetype == NONE && arg[1] ? detectfiletype(arg) : filetype;
 			switch (input->filetype) {
 			case ASM:    input->stages =                                     1<<ASSEMBLE|1<<LINK; break;
@@ -442,18 +1229,43 @@ ignore:
 		/* TODO: use a binary search for these long parameters */
 		if (strcmp(arg, "-nostdlib") == 0) {
 			flags.nostdlib = true;
+		} else if (strcmp(arg, "-memfd") == 0) {
+#ifdef __linux__
+			flags.memfd = true;
+#else
+			usage("-memfd is not supported on this system");
+#endif
 		} else if (strcmp(arg, "-nostdinc") == 0) {
 			arrayaddptr(&stages[PREPROCESS].cmd, arg);
+			pch.nostdinc = true;
 		} else if (strcmp(arg, "-static") == 0) {
 			arrayaddptr(&stages[LINK].cmd, arg);
+		} else if (strcmp(arg, "-ftime-report") == 0) {
+			stats.report = true;
+		} else if (strcmp(arg, "-fpromote-locals") == 0 || strcmp(arg, "-fsimplify-cfg") == 0) {
+			arrayaddptr(&stages[COMPILE].cmd, arg);
 		} else if (strcmp(arg, "-emit-qbe") == 0) {
 			if (last > COMPILE)
 				last = COMPILE;
+		} else if (strcmp(arg, "-emit-pch") == 0) {
+			pch.emit = true;
+			if (last > COMPILE)
+				last = COMPILE;
+		} else if (strcmp(arg, "-include-pch") == 0) {
+			if (!--argc)
+				usage(NULL);
+			pch.include = *++argv;
 		} else if (strcmp(arg, "-include") == 0 || strcmp(arg, "-idirafter") == 0 || strcmp(arg, "-isystem") == 0 || strcmp(arg, "-iquote") == 0) {
 			if (!--argc)
 				usage(NULL);
 			arrayaddptr(&stages[PREPROCESS].cmd, arg);
 			arrayaddptr(&stages[PREPROCESS].cmd, *++argv);
+			if (strcmp(arg, "-include") == 0) {
+				pch.unsupported = arg;
+			} else {
+				arrayaddptr(&pch.ppflags, arg);
+				arrayaddptr(&pch.ppflags, *argv);
+			}
 		} else if (strncmp(arg, "-std=", 5) == 0) {
 			/* pass through to the preprocessor, it may
 			 * affect its default definitions */
@@ -474,8 +1286,11 @@ ignore:
 					last = ASSEMBLE;
 				break;
 			case 'D':
+				arg = nextarg(&argv);
 				arrayaddptr(&stages[PREPROCESS].cmd, "-D");
-				arrayaddptr(&stages[PREPROCESS].cmd, nextarg(&argv));
+				arrayaddptr(&stages[PREPROCESS].cmd, arg);
+				arrayaddptr(&pch.ppflags, "-D");
+				arrayaddptr(&pch.ppflags, arg);
 				break;
 			case 'E':
 				if (last > PREPROCESS)
@@ -485,8 +1300,17 @@ ignore:
 				/* ignore */
 				break;
 			case 'I':
+				arg = nextarg(&argv);
 				arrayaddptr(&stages[PREPROCESS].cmd, "-I");
-				arrayaddptr(&stages[PREPROCESS].cmd, nextarg(&argv));
+				arrayaddptr(&stages[PREPROCESS].cmd, arg);
+				arrayaddptr(&pch.ppflags, "-I");
+				arrayaddptr(&pch.ppflags, arg);
+				break;
+			case 'j':
+				arg = nextarg(&argv);
+				maxjobs = strtoul(arg, &end, 10);
+				if (*end || maxjobs == 0)
+					usage("invalid job count '%s'", arg);
 				break;
 			case 'L':
 				arrayaddptr(&stages[LINK].cmd, "-L");
@@ -496,10 +1320,12 @@ ignore:
 				input = arrayadd(&inputs, sizeof(*input));
 				input->name = nextarg(&argv);
 				input->lib = true;
+				input->temp = false;
 				input->filetype = OBJ;
 				input->stages = 1<<LINK;
 				break;
 			case 'M':
+				pch.unsupported = arg;
 				if (strcmp(arg, "-M") == 0 || strcmp(arg, "-MM") == 0) {
 					arrayaddptr(&stages[PREPROCESS].cmd, arg);
 					if (last > PREPROCESS)
@@ -523,6 +1349,7 @@ ignore:
 				break;
 			case 'P':
 				arrayaddptr(&stages[PREPROCESS].cmd, "-P");
+				pch.unsupported = arg;
 				break;
 			case 'S':
 				if (last > CODEGEN)
@@ -532,8 +1359,11 @@ ignore:
 				arrayaddptr(&stages[LINK].cmd, "-s");
 				break;
 			case 'U':
+				arg = nextarg(&argv);
 				arrayaddptr(&stages[PREPROCESS].cmd, "-U");
-				arrayaddptr(&stages[PREPROCESS].cmd, nextarg(&argv));
+				arrayaddptr(&stages[PREPROCESS].cmd, arg);
+				arrayaddptr(&pch.ppflags, "-U");
+				arrayaddptr(&pch.ppflags, arg);
 				break;
 			case 'v':
 				flags.verbose = true;
@@ -541,7 +1371,7 @@ ignore:
 			case 'W':
 				if (arg[2] && arg[3] == ',') {
 					switch (arg[2]) {
-					case 'p': cmd = &stages[PREPROCESS].cmd; break;
+					case 'p': cmd = &stages[PREPROCESS].cmd; pch.unsupported = arg; break;
 					case 'a': cmd = &stages[ASSEMBLE].cmd; break;
 					case 'l': cmd = &stages[LINK].cmd; break;
 					default: usage(NULL);
@@ -581,8 +1411,14 @@ ignore:
 		}
 	}
 
+	if (pch.emit || pch.include)
+		pchinit(last);
 	for (i = 0; i < countof(stages); ++i)
 		stages[i].cmdbase = stages[i].cmd.len;
+	cacheinit();
+	statsinit();
+	if (stats.report)
+		atexit(printstats);
 	if (inputs.len == 0)
 		usage(NULL);
 	if (output) {
@@ -593,14 +1429,36 @@ ignore:
 			usage("cannot specify -o with multiple input files without linking");
 		}
 	}
+	if (maxjobs == 0) {
+		/* with a jobserver, the number of tokens is the only limit */
+		jobserverinit();
+		maxjobs = jobserver.rfd != -1 ? inputs.len / sizeof(*input) : cpucount();
+		jobserver.tokens = xmalloc(maxjobs);
+	}
+	jobs = xreallocarray(NULL, maxjobs, sizeof(*jobs));
 	arrayforeach (&inputs, input) {
+		if (pch.emit && (input->filetype == C || input->filetype == CHDR))
+			input->stages = 1<<COMPILE;
+		else if (pch.include && input->filetype == C)
+			input->stages &= ~(1<<PREPROCESS);
 		/* ignore the input if it doesn't participate in the last stage */
-		if (!(input->stages & 1 << last))
+		if (!(input->stages & 1 << last) || input->filetype == OBJ)
 			continue;
+		waitslot();
+		/* don't start any new jobs after one has failed */
+		if (failed)
+			break;
 		/* only run up through the last stage */
 		input->stages &= (1 << last + 1) - 1;
 		buildobj(input, output);
+		if (jobserver.rfd != -1)
+			puttokens(njobs);
 	}
+	waitjobs(0);
+	if (jobserver.rfd != -1)
+		puttokens(njobs);
+	if (failed)
+		exit(1);
 	if (last == LINK) {
 		if (!output)
 			output = "a.out";
@@ -13,7 +13,7 @@ mkexpr(enum exprkind k, struct type *t, struct expr *b)
 {
 	struct expr *e;
 
-	e = xmalloc(sizeof(*e));
+	e = arenaalloc(exprarena, sizeof(*e));
 	e->qual = QUALNONE;
 	e->type = t;
 	e->lvalue = false;
@@ -26,54 +26,6 @@ mkexpr(enum exprkind k, struct type *t, struct expr *b)
 	return e;
 }
 
-void
-delexpr(struct expr *e)
-{
-	struct expr *sub;
-
-	switch (e->kind) {
-	case EXPRCALL:
-		delexpr(e->base);
-		while (sub = e->u.call.args) {
-			e->u.call.args = sub->next;
-			delexpr(sub);
-		}
-		break;
-	case EXPRBITFIELD:
-	case EXPRINCDEC:
-	case EXPRUNARY:
-	case EXPRCAST:
-		delexpr(e->base);
-		break;
-	case EXPRBINARY:
-		delexpr(e->u.binary.l);
-		delexpr(e->u.binary.r);
-		break;
-	case EXPRCOND:
-		delexpr(e->base);
-		if (e->u.cond.t != e->base)
-			delexpr(e->u.cond.t);
-		delexpr(e->u.cond.f);
-		break;
-	/*
-	XXX: compound assignment causes some reuse of expressions,
-	so we can't free them without risk of a double-free
-
-	case EXPRASSIGN:
-		delexpr(e->assign.l);
-		delexpr(e->assign.r);
-		break;
-	*/
-	case EXPRCOMMA:
-		while (sub = e->base) {
-			e->base = sub->next;
-			delexpr(sub);
-		}
-		break;
-	}
-	free(e);
-}
-
 static struct expr *
 mkconstexpr(struct type *t, unsigned long long n)
 {
@@ -126,11 +78,8 @@ mkunaryexpr(enum tokenkind op, struct expr *base)
 
 	switch (op) {
 	case TBAND:
-		if (base->decayed) {
-			expr = base;
+		if (base->decayed)
 			base = base->base;
-			free(expr);
-		}
 		/*
 		Allow struct and union types even if they are not lvalues,
 		since we take their address when compiling member access.
@@ -480,7 +429,7 @@ hexval(int c)
 }
 
 static size_t
-decodechar(const char *src, uint_least32_t *chr, bool *hexoct, const char *desc, struct location *loc)
+decodechar(const char *src, uint_least32_t *chr, bool *hexoct, const char *desc, const struct location *loc)
 {
 	uint_least32_t c;
 	size_t n;
@@ -538,6 +487,41 @@ decodechar(const char *src, uint_least32_t *chr, bool *hexoct, const char *desc,
 	return s - (const unsigned char *)src;
 }
 
+/* get the value and type of a character constant */
+unsigned long long
+charconstval(const struct token *tok, struct type **type)
+{
+	struct type *t;
+	const char *src;
+	uint_least32_t chr;
+	unsigned long long val;
+	bool hexoct, ordinary;
+
+	src = tok->lit;
+	ordinary = false;
+	switch (*src) {
+	case 'L': ++src; t = targ->typewchar; break;
+	case 'u': ++src; t = *src == '8' ? ++src, &typeuchar : &typeushort; break;
+	case 'U': ++src; t = &typeuint; break;
+	default: t = &typeuchar, ordinary = true;
+	}
+	assert(*src == '\'');
+	++src;
+	src += decodechar(src, &chr, &hexoct, "character constant", &tok->loc);
+	if (hexoct && !typehasint(t, chr, false))
+		error(&tok->loc, "character constant escape is out of range");
+	val = chr;
+	if (ordinary) {
+		if (typechar.u.arith.issigned)
+			val = (val ^ 0x80) - 0x80;
+		t = &typeint;
+	}
+	if (*src != '\'')
+		error(&tok->loc, "character constant contains more than one character: %c", *src);
+	*type = t;
+	return val;
+}
+
 static size_t
 encodechar8(void *dst, uint_least32_t chr, bool hexoct)
 {
@@ -654,10 +638,8 @@ generic(struct scope *s)
 
 	next();
 	expect(TLPAREN, "after '_Generic'");
-	e = assignexpr(s);
+	want = assignexpr(s)->type;
 	expect(TCOMMA, "after generic selector expression");
-	want = e->type;
-	delexpr(e);
 	do {
 		if (consume(TDEFAULT)) {
 			if (def)
@@ -681,8 +663,6 @@ generic(struct scope *s)
 				if (match)
 					error(&tok.loc, "generic selector matches multiple associations");
 				match = e;
-			} else {
-				delexpr(e);
 			}
 		}
 	} while (consume(TCOMMA));
@@ -691,12 +671,24 @@ generic(struct scope *s)
 		if (!def)
 			error(&tok.loc, "generic selector matches no associations and no default was specified");
 		match = def;
-	} else if (def) {
-		delexpr(def);
 	}
 	return match;
 }
 
+/* array of character type `t` holding the data of the current #embed token */
+struct expr *
+embedexpr(struct type *t)
+{
+	struct stringlit *data;
+	struct expr *e;
+
+	data = (struct stringlit *)tok.lit;
+	e = mkexpr(EXPRSTRING, mkarraytype(t, QUALNONE, data->size), NULL);
+	e->lvalue = true;
+	e->u.string = *data;
+	return e;
+}
+
 /* 6.5 Expressions */
 static struct expr *
 primaryexpr(struct scope *s)
@@ -705,9 +697,7 @@ primaryexpr(struct scope *s)
 	struct decl *d;
 	struct type *t;
 	char *src, *end;
-	uint_least32_t chr;
 	unsigned long long val;
-	bool hexoct, ordinary;
 	int base;
 
 	switch (tok.kind) {
@@ -723,6 +713,9 @@ primaryexpr(struct scope *s)
 			e = decay(e);
 		next();
 		break;
+	case TEMBED:
+		expandembed();
+		return primaryexpr(s);
 	case TSTRINGLIT:
 		e = mkexpr(EXPRSTRING, NULL, NULL);
 		t = stringconcat(&e->u.string, false);
@@ -731,28 +724,8 @@ primaryexpr(struct scope *s)
 		e = decay(e);
 		break;
 	case TCHARCONST:
-		src = tok.lit;
-		ordinary = false;
-		switch (*src) {
-		case 'L': ++src; t = targ->typewchar; break;
-		case 'u': ++src; t = *src == '8' ? ++src, &typeuchar : &typeushort; break;
-		case 'U': ++src; t = &typeuint; break;
-		default: t = &typeuchar, ordinary = true;
-		}
-		assert(*src == '\'');
-		++src;
-		src += decodechar(src, &chr, &hexoct, "character constant", &tok.loc);
-		if (hexoct && !typehasint(t, chr, false))
-			error(&tok.loc, "character constant escape is out of range");
-		val = chr;
-		if (ordinary) {
-			if (typechar.u.arith.issigned)
-				val = (val ^ 0x80) - 0x80;
-			t = &typeint;
-		}
+		val = charconstval(&tok, &t);
 		e = mkconstexpr(t, val);
-		if (*src != '\'')
-			error(&tok.loc, "character constant contains more than one character: %c", *src);
 		next();
 		break;
 	case TNUMBER:
@@ -844,7 +817,6 @@ designator(struct scope *s, struct type *t, unsigned long long *offset)
 			m = typemember(t, name, offset);
 			if (!m)
 				error(&tok.loc, "%s has no member named '%s'", t->kind == TYPEUNION ? "union" : "struct", name);
-			free(name);
 			t = m->type;
 			break;
 		default:
@@ -876,7 +848,7 @@ builtinfunc(struct scope *s, enum builtinkind kind)
 		/* TODO: check that the expression and the expected value have type 'long' */
 		e = assignexpr(s);
 		expect(TCOMMA, "after expression");
-		delexpr(assignexpr(s));
+		assignexpr(s);
 		break;
 	case BUILTININFF:
 		e = mkexpr(EXPRCONST, &typefloat, NULL);
@@ -903,7 +875,6 @@ builtinfunc(struct scope *s, enum builtinkind kind)
 			error(&tok.loc, "struct/union has no member named '%s'", name);
 		designator(s, m->type, &offset);
 		e = mkconstexpr(&typeulong, offset);
-		free(name);
 		break;
 	case BUILTINTYPESCOMPATIBLEP:
 		t = typename(s, NULL, NULL);
@@ -953,7 +924,7 @@ builtinfunc(struct scope *s, enum builtinkind kind)
 		if (typeadjvalist == targ->typevalist)
 			e->base = mkunaryexpr(TBAND, e->base);
 		if (consume(TCOMMA))
-			delexpr(assignexpr(s));
+			assignexpr(s);
 		break;
 	default:
 		fatal("internal error; unknown builtin");
@@ -1240,7 +1211,7 @@ done:
 	return r;
 }
 
-static int
+int
 precedence(enum tokenkind t)
 {
 	switch (t) {
@@ -19,7 +19,18 @@ struct initparser {
 	/* TODO: keep track of type depth, and allocate maximum possible
 	   number of nested objects in initializer */
 	struct object obj[32], *cur, *sub;
-	struct init *init, **last;
+	struct init *init, *tail;
+	/* position after the last added initializer, or NULL after a designator */
+	struct init **last;
+	/* maximum end of any added initializer */
+	unsigned long long maxend;
+	/* tree of initializers that start after all preceding initializers end */
+	void *index;
+};
+
+struct initnode {
+	struct treenode node;
+	struct init *init;  /* NULL if the initializer was replaced */
 };
 
 struct init *
@@ -27,7 +38,7 @@ mkinit(unsigned long long start, unsigned long long end, struct bitfield bits, s
 {
 	struct init *init;
 
-	init = xmalloc(sizeof(*init));
+	init = arenaalloc(exprarena, sizeof(*init));
 	init->start = start;
 	init->end = end;
 	init->expr = expr;
@@ -37,29 +48,145 @@ mkinit(unsigned long long start, unsigned long long end, struct bitfield bits, s
 	return init;
 }
 
+static unsigned long long
+initstart(struct init *init)
+{
+	return init->start * 8 + init->bits.before;
+}
+
+static unsigned long long
+initend(struct init *init)
+{
+	return init->end * 8 - init->bits.after;
+}
+
+/* find the last indexed initializer starting at or before bit `key` */
+static struct init *
+initprev(void *index, unsigned long long key)
+{
+	struct initnode *n, *found;
+
+	for (;;) {
+		found = NULL;
+		for (n = index; n; n = n->node.child[n->node.key <= key]) {
+			if (n->node.key <= key)
+				found = n;
+		}
+		if (!found)
+			return NULL;
+		if (found->init)
+			return found->init;
+		/* skip replaced initializers */
+		if (found->node.key == 0)
+			return NULL;
+		key = found->node.key - 1;
+	}
+}
+
+static void
+initremove(void *index, struct init *init)
+{
+	struct initnode *n;
+	unsigned long long key;
+
+	key = initstart(init);
+	n = index;
+	while (n && n->node.key != key)
+		n = n->node.child[key > n->node.key];
+	if (n && n->init == init)
+		n->init = NULL;
+}
+
+static void
+indexfree(struct treenode *n)
+{
+	if (!n)
+		return;
+	indexfree(n->child[0]);
+	indexfree(n->child[1]);
+	free(n);
+}
+
 static void
 initadd(struct initparser *p, struct init *new)
 {
-	struct init **init, *old;
+	struct init **init, *old, *prev;
+	struct initnode *n;
+	unsigned long long end;
+
+	/* fast path for initializers in increasing order */
+	if (p->tail && initend(p->tail) <= initstart(new)) {
+		init = &p->tail->next;
+		end = p->maxend;
+		old = NULL;
+		goto insert;
+	}
 
-	init = p->last;
+	/*
+	`end` tracks an upper bound on the end of the initializers
+	before `new`, to determine whether it can be indexed.
+	*/
+	if (p->last) {
+		init = p->last;
+		end = p->maxend;
+	} else {
+		/*
+		After a designator, the search starts from the beginning.
+		Any initializers before the last indexed one that starts
+		at or before `new` end before `new` starts, so skip them.
+		*/
+		end = initstart(new);
+		prev = initprev(p->index, end);
+		init = prev ? &prev->next : &p->init;
+		if (prev && initend(prev) > initstart(new)) {
+			if (initend(prev) <= initend(new)) {
+				/* `new` replaces `prev`, so reuse its list entry */
+				initremove(p->index, prev);
+				for (old = prev->next; old && initend(old) <= initend(new); old = old->next)
+					initremove(p->index, old);
+				*prev = *new;
+				new = prev;
+				init = NULL;
+				goto insert;
+			}
+			/* `prev` covers `new` */
+			end = initend(prev);
+		}
+	}
 	for (; old = *init; init = &old->next) {
-		if (old->end * 8 - old->bits.after <= new->start * 8 + new->bits.before)
+		if (initend(old) <= initstart(new))
 			continue;
 		/* no overlap, insert before `old` */
-		if (new->end * 8 - new->bits.after <= old->start * 8 + old->bits.before)
+		if (initend(new) <= initstart(old))
 			break;
 		/* replace any initializers that `new` covers */
-		if (old->end * 8 - old->bits.after <= new->end * 8 - new->bits.after) {
-			do old = old->next;
-			while (old && old->end * 8 - old->bits.after <= new->end * 8 - new->bits.after);
+		if (initend(old) <= initend(new)) {
+			do {
+				initremove(p->index, old);
+				old = old->next;
+			} while (old && initend(old) <= initend(new));
 			break;
 		}
 		/* `old` covers `new`, keep looking */
+		if (end < initend(old))
+			end = initend(old);
 	}
+insert:
 	new->next = old;
-	*init = new;
+	if (init)
+		*init = new;
+	/* `old` no longer starts after everything before it ends */
+	if (old && initstart(old) < initend(new))
+		initremove(p->index, old);
+	if (end <= initstart(new) && initstart(new) < initend(new)) {
+		n = treeinsert(&p->index, initstart(new), sizeof(*n));
+		n->init = new;
+	}
 	p->last = &new->next;
+	if (p->maxend < initend(new))
+		p->maxend = initend(new);
+	if (!old)
+		p->tail = new;
 }
 
 static void
@@ -83,7 +210,7 @@ findmember(struct initparser *p, char *name)
 
 	for (m = p->sub->type->u.structunion.members; m; m = m->next) {
 		if (m->name) {
-			if (strcmp(m->name, name) == 0) {
+			if (m->name == name) {
 				p->sub->u.mem = m;
 				subobj(p, m->type, m->offset);
 				return true;
@@ -104,7 +231,7 @@ designator(struct scope *s, struct initparser *p)
 	struct type *t;
 	char *name;
 
-	p->last = &p->init;
+	p->last = NULL;
 	p->sub = p->cur;
 	for (;;) {
 		t = p->sub->type;
@@ -129,7 +256,6 @@ designator(struct scope *s, struct initparser *p)
 			name = expect(TIDENT, "for member designator");
 			if (!findmember(p, name))
 				error(&tok.loc, "%s has no member named '%s'", t->kind == TYPEUNION ? "union" : "struct", name);
-			free(name);
 			break;
 		default:
 			expect(TASSIGN, "after designator");
@@ -192,6 +318,39 @@ advance(struct initparser *p)
 	}
 }
 
+/*
+initialize the elements of a character array directly from the data
+of an #embed directive, if they fit in the array
+*/
+static bool
+embedinit(struct initparser *p)
+{
+	struct stringlit *data;
+	struct type *t;
+	struct expr *expr;
+	unsigned long long idx;
+
+	data = (struct stringlit *)tok.lit;
+	/* the first byte initializes the first scalar, as with an integer constant */
+	while (!(p->sub->type->prop & PROPSCALAR))
+		focus(p);
+	if (p->sub == p->obj || !(p->sub->type->prop & PROPCHAR))
+		return false;
+	t = p->sub[-1].type;
+	if (t->kind != TYPEARRAY)
+		return false;
+	idx = p->sub[-1].u.idx;
+	if (data->size > t->size - idx) {
+		if (!t->incomplete)
+			return false;
+		t->size = idx + data->size;
+	}
+	expr = embedexpr(p->sub->type);
+	initadd(p, mkinit(p->sub->offset, p->sub->offset + data->size, (struct bitfield){0}, expr));
+	p->sub[-1].u.idx += data->size - 1;
+	return true;
+}
+
 /* 6.7.9 Initialization */
 struct init *
 parseinit(struct scope *s, struct type *t)
@@ -207,7 +366,10 @@ parseinit(struct scope *s, struct type *t)
 	p.sub->type = t;
 	p.sub->iscur = false;
 	p.init = NULL;
+	p.tail = NULL;
 	p.last = &p.init;
+	p.maxend = 0;
+	p.index = NULL;
 	if (t->incomplete && t->kind != TYPEARRAY)
 		error(&tok.loc, "initializer specified for incomplete type");
 	if (t->kind == TYPEARRAY && t->base->size == 0)
@@ -237,6 +399,10 @@ parseinit(struct scope *s, struct type *t)
 			p.cur->iscur = true;
 			continue;
 		}
+		if (tok.kind == TEMBED && embedinit(&p)) {
+			next();
+			goto next;
+		}
 		expr = assignexpr(s);
 		for (;;) {
 			t = p.sub->type;
@@ -273,8 +439,10 @@ parseinit(struct scope *s, struct type *t)
 			if (p.sub->type->incomplete)
 				p.sub->type->incomplete = false;
 		next:
-			if (!p.cur)
+			if (!p.cur) {
+				indexfree(p.index);
 				return p.init;
+			}
 			if (tok.kind == TCOMMA) {
 				next();
 				if (tok.kind != TRBRACE)
@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "util.h"
 #include "arg.h"
 #include "cc.h"
@@ -15,17 +16,57 @@ usage(void)
 int
 main(int argc, char *argv[])
 {
-	bool pponly = false;
-	char *output = NULL, *target = NULL;
+	bool pponly = false, emitpch = false;
+	char *output = NULL, *target = NULL, *pch = NULL, *input, *arg;
 
 	argv0 = progname(argv[0], "cproc-qbe");
 	ARGBEGIN {
+	case 'D':
+		ppdefine(EARGF(usage()));
+		break;
 	case 'E':
 		pponly = true;
 		break;
+	case 'I':
+		ppadddir(PPDIRINCLUDE, EARGF(usage()));
+		break;
+	case 'e':
+		if (strcmp(EARGF(usage()), "mit-pch") != 0)
+			usage();
+		emitpch = true;
+		break;
+	case 'i':
+		/* -isystem, -iquote, -idirafter, and -include-pch take a separate argument */
+		arg = EARGF(usage());
+		if (!argv[1])
+			usage();
+		--argc, ++argv;
+		if (strcmp(arg, "system") == 0)
+			ppadddir(PPDIRSYSTEM, *argv);
+		else if (strcmp(arg, "quote") == 0)
+			ppadddir(PPDIRQUOTE, *argv);
+		else if (strcmp(arg, "dirafter") == 0)
+			ppadddir(PPDIRAFTER, *argv);
+		else if (strcmp(arg, "nclude-pch") == 0)
+			pch = *argv;
+		else
+			usage();
+		break;
+	case 'f':
+		arg = EARGF(usage());
+		if (strcmp(arg, "promote-locals") == 0)
+			optflags |= OPTPROMOTE;
+		else if (strcmp(arg, "simplify-cfg") == 0)
+			optflags |= OPTSIMPLIFY;
+		else
+			usage();
+		break;
 	case 't':
 		target = EARGF(usage());
 		break;
+	case 'U':
+		ppundef(EARGF(usage()));
+		break;
 	case 'o':
 		output = EARGF(usage());
 		break;
@@ -33,11 +74,14 @@ main(int argc, char *argv[])
 		usage();
 	} ARGEND
 
+	if (pponly && emitpch)
+		usage();
 	targinit(target);
 
 	if (output && !freopen(output, "w", stdout))
 		fatal("open %s:", output);
 
+	input = argc ? argv[0] : NULL;
 	if (argc) {
 		while (argc--)
 			scanfrom(argv[argc], NULL);
@@ -47,6 +91,15 @@ main(int argc, char *argv[])
 	}
 
 	ppinit();
+	if (!pponly) {
+		scopeinit();
+		/* IL from an included precompiled header is also kept */
+		if (emitpch)
+			emitcapture();
+	}
+	if (pch)
+		pchread(pch, pponly);
+	next();
 	if (pponly) {
 		ppflags |= PPNEWLINE;
 		while (tok.kind != TEOF) {
@@ -54,15 +107,19 @@ main(int argc, char *argv[])
 			next();
 		}
 	} else {
-		scopeinit();
 		while (tok.kind != TEOF) {
 			if (!decl(&filescope, NULL)) {
 				if (tok.kind == TSEMICOLON)
 					error(&tok.loc, "unexpected ';' at top-level");
 				error(&tok.loc, "expected declaration or function definition");
 			}
+			arenareset(&tmparena);
 		}
-		emittentativedefns();
+		if (emitpch)
+			pchwrite(input);
+		else
+			emittentativedefns();
+		emitflush();
 	}
 
 	fflush(stdout);
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "util.h"
@@ -59,7 +60,7 @@ keyequal(struct mapkey *k1, struct mapkey *k2)
 {
 	if (k1->hash != k2->hash || k1->len != k2->len)
 		return false;
-	return memcmp(k1->str, k2->str, k1->len) == 0;
+	return k1->str == k2->str || memcmp(k1->str, k2->str, k1->len) == 0;
 }
 
 static size_t
@@ -117,3 +118,55 @@ mapget(struct map *h, struct mapkey *k)
 	i = keyindex(h, k);
 	return h->keys[i].str ? h->vals[i] : NULL;
 }
+
+/* interned strings, each preceded by its map key */
+
+struct atom {
+	struct mapkey key;
+	int data;
+	char str[];
+};
+
+static struct map atoms;
+static struct arena atomarena;
+
+char *
+intern(const char *str, size_t len)
+{
+	struct mapkey k;
+	struct atom *a;
+
+	if (!atoms.cap)
+		mapinit(&atoms, 1<<12);
+	mapkey(&k, str, len);
+	a = mapget(&atoms, &k);
+	if (a)
+		return a->str;
+	a = arenaalloc(&atomarena, offsetof(struct atom, str) + len + 1);
+	memcpy(a->str, str, len);
+	a->str[len] = '\0';
+	a->key = k;
+	a->key.str = a->str;
+	a->data = 0;
+	*mapput(&atoms, &a->key) = a;
+
+	return a->str;
+}
+
+static struct atom *
+atom(const char *str)
+{
+	return (struct atom *)(str - offsetof(struct atom, str));
+}
+
+void
+atomkey(struct mapkey *k, const char *str)
+{
+	*k = atom(str)->key;
+}
+
+int *
+atomdata(const char *str)
+{
+	return &atom(str)->data;
+}
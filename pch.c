@@ -0,0 +1,746 @@
+/*
+Precompiled headers
+
+A precompiled header holds the state of the compiler at the end of a
+header: the files it read along with their absolute paths, modification
+times, and sizes; the macros defined at its end; its file scope
+declarations and tags with the types they refer to; and the IL emitted
+for it so far. It is loaded before the main file, so that the header
+is neither preprocessed nor parsed again.
+
+The format is private to the cproc-qbe binary that wrote it. Integers
+are stored in 7-bit groups with the high bit set on all but the last.
+The spellings of tokens, identifiers, and the names of files are stored
+once in a string table and referred to by index, so that each one is
+only interned once when loading. Strings are stored with their
+terminating null byte so that they can be used in place in the loaded
+file.
+
+Types and declarations form a graph with cycles, so they are numbered
+in the order they are first referred to, and each one's fields are
+written in a separate record. Index 0 is a null pointer, and the types
+that exist before any declaration come first and have no record.
+*/
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "cc.h"
+
+static const char pchmagic[] = "cproc-pch 1";
+
+enum {
+	RECORDEND,
+	RECORDTYPE,
+	RECORDDECL,
+};
+
+/* the types and declarations of the graph, in order of their index */
+struct graph {
+	struct array types, decls;
+	/* used when writing to find the index of an object */
+	void *typeindex, *declindex;
+	size_t nbuiltin;
+};
+
+struct graphnode {
+	struct treenode node;
+	unsigned long long index;
+};
+
+void
+pchputint(struct array *buf, unsigned long long v)
+{
+	unsigned char b[10], *p;
+
+	for (p = b; v > 0x7f; v >>= 7)
+		*p++ = v & 0x7f | 0x80;
+	*p++ = v;
+	arrayaddbuf(buf, b, p - b);
+}
+
+void
+pchputstr(struct array *buf, const char *s)
+{
+	size_t n;
+
+	n = s ? strlen(s) + 1 : 0;
+	pchputint(buf, n);
+	if (n > 0)
+		arrayaddbuf(buf, s, n);
+}
+
+/* write a reference to a string in the table, adding it if necessary */
+void
+pchputref(struct pchwriter *w, const char *s)
+{
+	struct mapkey k;
+	void **entry;
+
+	if (!s) {
+		pchputint(&w->body, 0);
+		return;
+	}
+	mapkey(&k, s, strlen(s));
+	entry = mapput(&w->index, &k);
+	if (!*entry) {
+		arrayaddptr(&w->strs, (char *)s);
+		*entry = (void *)(uintptr_t)(w->strs.len / sizeof(char *));
+	}
+	pchputint(&w->body, (uintptr_t)*entry);
+}
+
+noreturn void
+pchcorrupt(struct pchreader *r)
+{
+	fatal("%s: precompiled header is corrupt", r->name);
+}
+
+unsigned long long
+pchgetint(struct pchreader *r)
+{
+	unsigned long long v;
+	int shift;
+
+	v = 0;
+	for (shift = 0;; shift += 7) {
+		if (r->pos == r->end)
+			fatal("%s: precompiled header is truncated", r->name);
+		if (shift > 63)
+			pchcorrupt(r);
+		v |= (unsigned long long)(*r->pos & 0x7f) << shift;
+		if (!(*r->pos++ & 0x80))
+			break;
+	}
+	return v;
+}
+
+/* read a number of elements, each of which takes at least one byte */
+size_t
+pchgetcount(struct pchreader *r)
+{
+	unsigned long long n;
+
+	n = pchgetint(r);
+	if (n > r->end - r->pos)
+		fatal("%s: precompiled header is truncated", r->name);
+	return n;
+}
+
+char *
+pchgetstr(struct pchreader *r)
+{
+	unsigned long long n;
+	char *s;
+
+	n = pchgetint(r);
+	if (n == 0)
+		return NULL;
+	if (r->end - r->pos < n || r->pos[n - 1] != '\0')
+		pchcorrupt(r);
+	s = (char *)r->pos;
+	r->pos += n;
+	return s;
+}
+
+char *
+pchgetref(struct pchreader *r)
+{
+	unsigned long long i;
+
+	i = pchgetint(r);
+	if (i > r->nstrs)
+		pchcorrupt(r);
+	return i ? r->strs[i - 1] : NULL;
+}
+
+static void
+graphadd(struct graph *g, struct type *t)
+{
+	struct graphnode *n;
+
+	if (!t)
+		return;
+	n = treeinsert(&g->typeindex, (uintptr_t)t, sizeof(*n));
+	if (n->node.new) {
+		arrayaddptr(&g->types, t);
+		n->index = g->types.len / sizeof(t);
+	}
+}
+
+/* add the types that exist before any declaration, which have no record */
+static void
+graphinit(struct graph *g)
+{
+	static struct type *const builtins[] = {
+		&typevoid, &typebool,
+		&typechar, &typeschar, &typeuchar,
+		&typeshort, &typeushort,
+		&typeint, &typeuint,
+		&typelong, &typeulong,
+		&typellong, &typeullong,
+		&typefloat, &typedouble, &typeldouble,
+		&typenullptr,
+	};
+	size_t i;
+
+	for (i = 0; i < countof(builtins); ++i)
+		graphadd(g, builtins[i]);
+	graphadd(g, targ->typevalist);
+	graphadd(g, targ->typevalist->base);
+	graphadd(g, typeadjvalist);
+	g->nbuiltin = g->types.len / sizeof(struct type *);
+}
+
+static void
+puttyperef(struct pchwriter *w, struct graph *g, struct type *t)
+{
+	struct graphnode *n;
+
+	if (!t) {
+		pchputint(&w->body, 0);
+		return;
+	}
+	graphadd(g, t);
+	n = treeinsert(&g->typeindex, (uintptr_t)t, sizeof(*n));
+	pchputint(&w->body, n->index);
+}
+
+static void
+putdeclref(struct pchwriter *w, struct graph *g, struct decl *d)
+{
+	struct graphnode *n;
+
+	if (!d) {
+		pchputint(&w->body, 0);
+		return;
+	}
+	n = treeinsert(&g->declindex, (uintptr_t)d, sizeof(*n));
+	if (n->node.new) {
+		arrayaddptr(&g->decls, d);
+		n->index = g->decls.len / sizeof(d);
+	}
+	pchputint(&w->body, n->index);
+}
+
+static void
+puttype(struct pchwriter *w, struct graph *g, struct type *t)
+{
+	struct member *m;
+	struct expr *e;
+	size_t n;
+
+	pchputint(&w->body, t->kind);
+	pchputint(&w->body, t->prop);
+	/* function types have no size or alignment */
+	if (t->kind != TYPEFUNC) {
+		pchputint(&w->body, t->align);
+		pchputint(&w->body, t->size);
+	}
+	pchputint(&w->body, t->incomplete);
+	pchputvalue(w, t->value);
+	/* fields are only written for the kinds of type that set them */
+	switch (t->kind) {
+	case TYPEPOINTER:
+	case TYPEARRAY:
+	case TYPEFUNC:
+	case TYPEENUM:
+		puttyperef(w, g, t->base);
+		pchputint(&w->body, t->qual);
+		break;
+	}
+	switch (t->kind) {
+	case TYPEENUM:
+		/* an enum without a fixed underlying type has no width until it is complete */
+		if (t->incomplete)
+			break;
+		/* fallthrough */
+	case TYPEBOOL:
+	case TYPECHAR:
+	case TYPESHORT:
+	case TYPEINT:
+	case TYPELONG:
+	case TYPELLONG:
+	case TYPEFLOAT:
+	case TYPEDOUBLE:
+	case TYPELDOUBLE:
+	case TYPEBITINT:
+		pchputint(&w->body, t->u.arith.issigned);
+		pchputint(&w->body, t->u.arith.iscomplex);
+		pchputint(&w->body, t->u.arith.width);
+		break;
+	case TYPEARRAY:
+		/* only a constant length is compared after parsing */
+		e = t->u.array.length;
+		if (e && e->kind == EXPRCONST) {
+			pchputint(&w->body, 1);
+			pchputint(&w->body, e->u.constant.u);
+		} else {
+			pchputint(&w->body, 0);
+		}
+		pchputint(&w->body, t->u.array.ptrqual);
+		break;
+	case TYPEFUNC:
+		pchputint(&w->body, t->u.func.isvararg);
+		putdeclref(w, g, t->u.func.params);
+		pchputint(&w->body, t->u.func.nparam);
+		break;
+	case TYPESTRUCT:
+	case TYPEUNION:
+		pchputref(w, t->u.structunion.tag);
+		n = 0;
+		for (m = t->u.structunion.members; m; m = m->next)
+			++n;
+		pchputint(&w->body, n);
+		for (m = t->u.structunion.members; m; m = m->next) {
+			pchputref(w, m->name);
+			puttyperef(w, g, m->type);
+			pchputint(&w->body, m->qual);
+			pchputint(&w->body, m->offset);
+			pchputint(&w->body, m->bits.before);
+			pchputint(&w->body, m->bits.after);
+		}
+		break;
+	}
+}
+
+static void
+putdecl(struct pchwriter *w, struct graph *g, struct decl *d)
+{
+	pchputref(w, d->name);
+	pchputint(&w->body, d->kind);
+	pchputint(&w->body, d->linkage);
+	puttyperef(w, g, d->type);
+	pchputint(&w->body, d->qual);
+	pchputref(w, d->asmname);
+	pchputint(&w->body, d->defined);
+	pchputint(&w->body, d->tentative);
+	putdeclref(w, g, d->next);
+	switch (d->kind) {
+	case DECLOBJECT:
+		pchputint(&w->body, d->u.obj.align);
+		pchputint(&w->body, d->u.obj.storage);
+		/* parameters may refer to temporaries of the function that defined them */
+		pchputvalue(w, d->u.obj.storage == SDAUTO ? NULL : d->value);
+		break;
+	case DECLFUNC:
+		pchputint(&w->body, d->u.func.inlinedefn);
+		pchputint(&w->body, d->u.func.isnoreturn);
+		pchputvalue(w, d->value);
+		break;
+	case DECLCONST:
+		pchputint(&w->body, d->u.enumconst);
+		break;
+	}
+}
+
+/* whether a declaration is added by scopeinit, and so doesn't need to be written */
+static bool
+isbuiltin(struct decl *d)
+{
+	return d->kind == DECLBUILTIN || d->kind == DECLTYPE && strcmp(d->name, "__builtin_va_list") == 0;
+}
+
+/* write the file scope declarations and tags, and the types and declarations they refer to */
+static void
+putdecls(struct pchwriter *w)
+{
+	struct graph g = {0};
+	struct type **t;
+	struct decl *d;
+	size_t i, n, types, decls;
+
+	graphinit(&g);
+	arrayforeach (&g.types, t)
+		pchputvalue(w, (*t)->value);
+
+	n = 0;
+	for (i = 0; i < filescope.decls.cap; ++i) {
+		d = filescope.decls.keys[i].str ? filescope.decls.vals[i] : NULL;
+		n += d && !isbuiltin(d);
+	}
+	pchputint(&w->body, n);
+	for (i = 0; i < filescope.decls.cap; ++i) {
+		d = filescope.decls.keys[i].str ? filescope.decls.vals[i] : NULL;
+		if (d && !isbuiltin(d))
+			putdeclref(w, &g, d);
+	}
+	n = 0;
+	for (i = 0; i < filescope.tags.cap; ++i)
+		n += filescope.tags.keys[i].str != NULL;
+	pchputint(&w->body, n);
+	for (i = 0; i < filescope.tags.cap; ++i) {
+		if (!filescope.tags.keys[i].str)
+			continue;
+		pchputref(w, filescope.tags.keys[i].str);
+		puttyperef(w, &g, filescope.tags.vals[i]);
+	}
+	n = 0;
+	for (d = tentativedefns; d; d = d->next)
+		++n;
+	pchputint(&w->body, n);
+	for (d = tentativedefns; d; d = d->next)
+		putdeclref(w, &g, d);
+	n = 0;
+	for (i = 0; i < stringdecls.cap; ++i)
+		n += stringdecls.keys[i].str != NULL;
+	pchputint(&w->body, n);
+	for (i = 0; i < stringdecls.cap; ++i) {
+		if (!stringdecls.keys[i].str)
+			continue;
+		pchputint(&w->body, stringdecls.keys[i].len);
+		arrayaddbuf(&w->body, stringdecls.keys[i].str, stringdecls.keys[i].len);
+		putdeclref(w, &g, stringdecls.vals[i]);
+	}
+
+	/* records may refer to more objects, so the lengths are checked each time */
+	types = g.nbuiltin;
+	decls = 0;
+	for (;;) {
+		if (types < g.types.len / sizeof(struct type *)) {
+			pchputint(&w->body, RECORDTYPE);
+			puttype(w, &g, ((struct type **)g.types.val)[types++]);
+		} else if (decls < g.decls.len / sizeof(struct decl *)) {
+			pchputint(&w->body, RECORDDECL);
+			putdecl(w, &g, ((struct decl **)g.decls.val)[decls++]);
+		} else {
+			break;
+		}
+	}
+	pchputint(&w->body, RECORDEND);
+}
+
+/* get the object with the given index, allocating it and any before it */
+static void *
+graphget(struct pchreader *r, struct array *objs, unsigned long long i, size_t size)
+{
+	size_t n;
+	void *p;
+
+	n = objs->len / sizeof(p);
+	if (i > n) {
+		/* each object has a record, which takes at least one byte */
+		if (i - n > r->end - r->pos)
+			pchcorrupt(r);
+		for (; n < i; ++n) {
+			p = arenaalloc(&permarena, size);
+			memset(p, 0, size);
+			arrayaddptr(objs, p);
+		}
+	}
+	return ((void **)objs->val)[i - 1];
+}
+
+static struct type *
+gettyperef(struct pchreader *r, struct graph *g)
+{
+	unsigned long long i;
+
+	i = pchgetint(r);
+	return i ? graphget(r, &g->types, i, sizeof(struct type)) : NULL;
+}
+
+static struct decl *
+getdeclref(struct pchreader *r, struct graph *g)
+{
+	unsigned long long i;
+
+	i = pchgetint(r);
+	return i ? graphget(r, &g->decls, i, sizeof(struct decl)) : NULL;
+}
+
+static void
+gettype(struct pchreader *r, struct graph *g, struct type *t)
+{
+	struct member **end, *m;
+	struct expr *e;
+	size_t n;
+
+	t->kind = pchgetint(r);
+	if (t->kind == TYPENONE || t->kind > TYPEBITINT)
+		pchcorrupt(r);
+	t->prop = pchgetint(r);
+	if (t->kind != TYPEFUNC) {
+		t->align = pchgetint(r);
+		t->size = pchgetint(r);
+	}
+	t->incomplete = pchgetint(r);
+	t->value = pchgetvalue(r);
+	switch (t->kind) {
+	case TYPEPOINTER:
+	case TYPEARRAY:
+	case TYPEFUNC:
+		t->base = gettyperef(r, g);
+		if (!t->base)
+			pchcorrupt(r);
+		t->qual = pchgetint(r);
+		break;
+	case TYPEENUM:
+		t->base = gettyperef(r, g);
+		t->qual = pchgetint(r);
+		break;
+	}
+	switch (t->kind) {
+	case TYPEENUM:
+		if (t->incomplete)
+			break;
+		/* fallthrough */
+	case TYPEBOOL:
+	case TYPECHAR:
+	case TYPESHORT:
+	case TYPEINT:
+	case TYPELONG:
+	case TYPELLONG:
+	case TYPEFLOAT:
+	case TYPEDOUBLE:
+	case TYPELDOUBLE:
+	case TYPEBITINT:
+		t->u.arith.issigned = pchgetint(r);
+		t->u.arith.iscomplex = pchgetint(r);
+		t->u.arith.width = pchgetint(r);
+		break;
+	case TYPEARRAY:
+		if (pchgetint(r)) {
+			e = arenaalloc(&permarena, sizeof(*e));
+			memset(e, 0, sizeof(*e));
+			e->kind = EXPRCONST;
+			e->type = &typeulong;
+			e->u.constant.u = pchgetint(r);
+			t->u.array.length = e;
+		}
+		t->u.array.ptrqual = pchgetint(r);
+		break;
+	case TYPEFUNC:
+		t->u.func.isvararg = pchgetint(r);
+		t->u.func.params = getdeclref(r, g);
+		t->u.func.nparam = pchgetint(r);
+		break;
+	case TYPESTRUCT:
+	case TYPEUNION:
+		t->u.structunion.tag = pchgetref(r);
+		end = &t->u.structunion.members;
+		for (n = pchgetcount(r); n > 0; --n) {
+			m = arenaalloc(&permarena, sizeof(*m));
+			m->name = pchgetref(r);
+			m->type = gettyperef(r, g);
+			if (!m->type)
+				pchcorrupt(r);
+			m->qual = pchgetint(r);
+			m->offset = pchgetint(r);
+			m->bits.before = pchgetint(r);
+			m->bits.after = pchgetint(r);
+			*end = m;
+			end = &m->next;
+		}
+		*end = NULL;
+		break;
+	}
+}
+
+static void
+getdecl(struct pchreader *r, struct graph *g, struct decl *d)
+{
+	d->name = pchgetref(r);
+	d->kind = pchgetint(r);
+	if (d->kind >= DECLBUILTIN)
+		pchcorrupt(r);
+	d->linkage = pchgetint(r);
+	if (d->linkage > LINKEXTERN)
+		pchcorrupt(r);
+	d->type = gettyperef(r, g);
+	if (!d->type)
+		pchcorrupt(r);
+	d->qual = pchgetint(r);
+	d->asmname = pchgetref(r);
+	d->defined = pchgetint(r);
+	d->tentative = pchgetint(r);
+	d->next = getdeclref(r, g);
+	switch (d->kind) {
+	case DECLOBJECT:
+		d->u.obj.align = pchgetint(r);
+		d->u.obj.storage = pchgetint(r);
+		if (d->u.obj.storage > SDAUTO)
+			pchcorrupt(r);
+		d->value = pchgetvalue(r);
+		break;
+	case DECLFUNC:
+		d->u.func.inlinedefn = pchgetint(r);
+		d->u.func.isnoreturn = pchgetint(r);
+		d->value = pchgetvalue(r);
+		break;
+	case DECLCONST:
+		d->u.enumconst = pchgetint(r);
+		d->value = mkintconst(d->u.enumconst);
+		break;
+	}
+}
+
+static void
+getdecls(struct pchreader *r)
+{
+	struct graph g = {0};
+	struct array decls = {0};
+	struct type **t, *type;
+	struct decl **d, *decl;
+	struct mapkey k;
+	char *tag;
+	size_t n, size, ntype, ndecl;
+	void *data;
+
+	graphinit(&g);
+	arrayforeach (&g.types, t)
+		(*t)->value = pchgetvalue(r);
+
+	/* declarations are keyed by their name, so they are added to the scope once their records are read */
+	for (n = pchgetcount(r); n > 0; --n) {
+		decl = getdeclref(r, &g);
+		if (!decl)
+			pchcorrupt(r);
+		arrayaddptr(&decls, decl);
+	}
+	for (n = pchgetcount(r); n > 0; --n) {
+		tag = pchgetref(r);
+		type = gettyperef(r, &g);
+		if (!tag || !type)
+			pchcorrupt(r);
+		scopeputtag(&filescope, tag, type);
+	}
+	for (n = pchgetcount(r); n > 0; --n) {
+		decl = getdeclref(r, &g);
+		if (!decl)
+			pchcorrupt(r);
+		tentativedefn(decl);
+	}
+	if (!stringdecls.len)
+		mapinit(&stringdecls, 64);
+	for (n = pchgetcount(r); n > 0; --n) {
+		size = pchgetcount(r);
+		data = xmalloc(size);
+		memcpy(data, r->pos, size);
+		r->pos += size;
+		mapkey(&k, data, size);
+		decl = getdeclref(r, &g);
+		if (!decl)
+			pchcorrupt(r);
+		*mapput(&stringdecls, &k) = decl;
+	}
+
+	ntype = g.nbuiltin;
+	ndecl = 0;
+	for (;;) {
+		switch (pchgetint(r)) {
+		case RECORDTYPE:
+			gettype(r, &g, graphget(r, &g.types, ++ntype, sizeof(struct type)));
+			continue;
+		case RECORDDECL:
+			getdecl(r, &g, graphget(r, &g.decls, ++ndecl, sizeof(struct decl)));
+			continue;
+		case RECORDEND:
+			break;
+		default:
+			pchcorrupt(r);
+		}
+		break;
+	}
+	/* every object that was referred to must have had a record */
+	if (ntype != g.types.len / sizeof(struct type *) || ndecl != g.decls.len / sizeof(struct decl *))
+		pchcorrupt(r);
+
+	arrayforeach (&decls, d) {
+		if (!(*d)->name)
+			pchcorrupt(r);
+		scopeputdecl(&filescope, *d);
+	}
+	free(decls.val);
+}
+
+static void
+flush(struct array *buf)
+{
+	if (fwrite(buf->val, 1, buf->len, stdout) != buf->len)
+		fatal("write:");
+}
+
+/* write a precompiled header for the input, after it has been parsed */
+void
+pchwrite(const char *input)
+{
+	struct pchwriter w = {0};
+	char **str;
+
+	mapinit(&w.index, 1<<12);
+	arrayaddbuf(&w.head, pchmagic, sizeof(pchmagic));
+	pchputstr(&w.head, targ->name);
+	ppwritepch(&w, input);
+	putdecls(&w);
+	emitwritepch(&w);
+	pchputint(&w.head, w.strs.len / sizeof(*str));
+	arrayforeach (&w.strs, str)
+		pchputstr(&w.head, *str);
+	flush(&w.head);
+	flush(&w.body);
+}
+
+/* load a precompiled header, checking that it is up to date; only the macros are needed with -E */
+void
+pchread(const char *name, bool pponly)
+{
+	struct pchreader r;
+	char magic[sizeof(pchmagic)], *target, *str;
+	size_t i, len, cap;
+	FILE *f;
+
+	f = fopen(name, "rb");
+	if (!f)
+		fatal("open %s:", name);
+	r.pos = NULL;
+	len = 0;
+	cap = 1<<16;
+	for (;;) {
+		r.pos = xreallocarray(r.pos, cap, 1);
+		len += fread(r.pos + len, 1, cap - len, f);
+		if (len < cap)
+			break;
+		cap *= 2;
+	}
+	if (ferror(f))
+		fatal("read %s:", name);
+	fclose(f);
+	/* the loaded file is kept, since strings are used in place */
+	r.name = name;
+	r.end = r.pos + len;
+	r.file = NULL;
+
+	if (len < sizeof(magic))
+		fatal("%s: precompiled header is truncated", name);
+	memcpy(magic, r.pos, sizeof(magic));
+	r.pos += sizeof(magic);
+	if (memcmp(magic, pchmagic, sizeof(magic)) != 0)
+		fatal("%s: not a precompiled header", name);
+	target = pchgetstr(&r);
+	if (!target || strcmp(target, targ->name) != 0)
+		fatal("%s: precompiled header was built for target %s", name, target ? target : "(none)");
+	ppreaddeps(&r);
+
+	/* intern the strings up front, so that each is only hashed once */
+	r.nstrs = pchgetcount(&r);
+	r.strs = xreallocarray(NULL, r.nstrs, sizeof(r.strs[0]));
+	for (i = 0; i < r.nstrs; ++i) {
+		str = pchgetstr(&r);
+		if (!str)
+			pchcorrupt(&r);
+		r.strs[i] = intern(str, strlen(str));
+	}
+
+	ppreadmacros(&r);
+	if (!pponly) {
+		getdecls(&r);
+		emitreadpch(&r);
+		if (r.pos != r.end)
+			pchcorrupt(&r);
+	}
+	free(r.strs);
+}
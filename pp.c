@@ -1,9 +1,14 @@
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "util.h"
 #include "cc.h"
 
@@ -13,12 +18,16 @@ struct macroparam {
 		PARAMTOK = 1<<0,  /* the parameter is used normally */
 		PARAMSTR = 1<<1,  /* the parameter is used with the '#' operator */
 		PARAMVAR = 1<<2,  /* the parameter is __VA_ARGS__ */
+		PARAMRAW = 1<<3,  /* the parameter is an operand of the '##' operator */
 	} flags;
 };
 
 struct macroarg {
 	struct token *token;
 	size_t ntoken;
+	/* argument tokens before macro expansion */
+	struct token *raw;
+	size_t nraw;
 	/* stringized argument */
 	struct token str;
 };
@@ -31,14 +40,20 @@ struct macro {
 	char *name;
 	/* whether or not this macro is ineligible for expansion */
 	bool hide;
+	/* whether the replacement list contains the '##' operator */
+	bool paste;
 	/* parameters of function-like macro */
 	struct macroparam *param;
 	size_t nparam;
 	/* argument tokens of macro invocation */
 	struct macroarg *arg;
+	/* index of the argument region in argregions */
+	size_t region;
 	/* replacement list */
 	struct token *token;
 	size_t ntoken;
+	/* replacement list after substitution, for macros with '##' */
+	struct array subst;
 };
 
 struct frame {
@@ -47,19 +62,189 @@ struct frame {
 	struct macro *macro;
 };
 
+/* arena storage for the arguments of one macro invocation */
+struct argregion {
+	struct arena mark;
+	bool done;
+};
+
+/* state of an #if group */
+struct cond {
+	/* whether one of the groups has been included */
+	bool taken;
+	bool sawelse;
+	/* number of open files when the group started */
+	size_t depth;
+	struct location loc;
+};
+
+/* value in a preprocessor conditional expression */
+struct ppval {
+	unsigned long long val;
+	bool issigned;
+};
+
+/* identity of a file, so that it is recognized when included through a different path */
+struct fileid {
+	unsigned long long dev, ino;
+};
+
+/* a file that has been included */
+struct incfile {
+	struct fileid id;
+	char *path;
+	/* used to check whether a precompiled header is up to date */
+	unsigned long long mtime, mtimensec, size;
+	/* whether the file is marked with #pragma once */
+	bool once;
+	/* macro that guards the entire contents of the file, or NULL */
+	char *guard;
+};
+
+/* an included file that is being read */
+struct include {
+	struct incfile *file;
+	size_t depth;
+	/* number of search directories up to the one the file was found in, or 0 */
+	size_t dir;
+	/* detection of an include guard */
+	enum {
+		GUARDSTART,  /* nothing but whitespace so far */
+		GUARDIN,     /* inside the #ifndef group */
+		GUARDEND,    /* after the matching #endif */
+		GUARDNONE,   /* the file is not guarded */
+	} state;
+	char *guard;
+	/* index of the #ifndef in conds */
+	size_t cond;
+};
+
 enum ppflags ppflags;
 
 static struct array ctx;
 static struct map macros;
+static char *vaargs, *defined, *hasinclude;
+/* macros whose replacement depends on where and when they are expanded */
+static char *filemacro, *linemacro, *datemacro, *timemacro;
 /* number of macros currently undergoing expansion */
 static size_t macrodepth;
+/* location of the outermost macro invocation being expanded */
+static struct location exploc;
+/* arguments of the macro invocations in ctx, and their regions in order of allocation */
+static struct arena argarena;
+static struct array argregions;
+/* stacks of arguments being collected by nested invocations */
+static struct array argstack, argtoks, argraws, argstrs;
+/* stack of open conditional groups */
+static struct array conds;
+/* include search directories for each enum ppdir */
+static struct array incdirs[4];
+/* files that have been included, by their fileid, or by path if the host can't identify files */
+static struct map incfiles;
+/* stack of included files being read */
+static struct array includes;
+/* whether a directive is being read, so macro invocations end at the newline */
+static bool indirective;
+/* -D and -U options, as directives */
+static struct array cmdline;
 
-void
-ppinit(void)
-{
-	mapinit(&macros, 64);
-	next();
-}
+/* predefined macros common to all targets, in the form of -D options */
+static const char *const predefined[] = {
+	"__STDC__",
+	"__STDC_HOSTED__",
+	"__STDC_VERSION__=201112L",
+	"__STDC_UTF_16__",
+	"__STDC_UTF_32__",
+	"__STDC_NO_ATOMICS__",
+	"__STDC_NO_COMPLEX__",
+
+	"__LP64__",
+	"_LP64",
+	"__CHAR_BIT__=8",
+	"__ORDER_LITTLE_ENDIAN__=1234",
+	"__ORDER_BIG_ENDIAN__=4321",
+	"__ORDER_PDP_ENDIAN__=3412",
+	"__BYTE_ORDER__=__ORDER_LITTLE_ENDIAN__",
+
+	"__SIZEOF_SHORT__=2",
+	"__SIZEOF_INT__=4",
+	"__SIZEOF_LONG__=8",
+	"__SIZEOF_LONG_LONG__=8",
+	"__SIZEOF_POINTER__=8",
+	"__SIZEOF_SIZE_T__=8",
+	"__SIZEOF_PTRDIFF_T__=8",
+	"__SIZEOF_WCHAR_T__=4",
+	"__SIZEOF_WINT_T__=4",
+	"__SIZEOF_FLOAT__=4",
+	"__SIZEOF_DOUBLE__=8",
+	"__SIZEOF_LONG_DOUBLE__=16",
+
+	"__SIZE_TYPE__=unsigned long",
+	"__PTRDIFF_TYPE__=long",
+	"__INTMAX_TYPE__=long",
+	"__UINTMAX_TYPE__=unsigned long",
+	"__INTPTR_TYPE__=long",
+	"__UINTPTR_TYPE__=unsigned long",
+	"__WINT_TYPE__=unsigned int",
+	"__CHAR16_TYPE__=unsigned short",
+	"__CHAR32_TYPE__=unsigned int",
+
+	"__SCHAR_MAX__=0x7f",
+	"__SHRT_MAX__=0x7fff",
+	"__INT_MAX__=0x7fffffff",
+	"__LONG_MAX__=0x7fffffffffffffffL",
+	"__LONG_LONG_MAX__=0x7fffffffffffffffLL",
+	"__SIZE_MAX__=0xffffffffffffffffUL",
+	"__PTRDIFF_MAX__=0x7fffffffffffffffL",
+	"__INTMAX_MAX__=0x7fffffffffffffffL",
+	"__UINTMAX_MAX__=0xffffffffffffffffUL",
+	"__INTPTR_MAX__=0x7fffffffffffffffL",
+	"__UINTPTR_MAX__=0xffffffffffffffffUL",
+	"__WINT_MAX__=0xffffffffU",
+	"__WINT_MIN__=0U",
+	"__SCHAR_WIDTH__=8",
+	"__SHRT_WIDTH__=16",
+	"__INT_WIDTH__=32",
+	"__LONG_WIDTH__=64",
+	"__LONG_LONG_WIDTH__=64",
+	"__PTRDIFF_WIDTH__=64",
+	"__SIZE_WIDTH__=64",
+	"__WCHAR_WIDTH__=32",
+	"__WINT_WIDTH__=32",
+	"__INTMAX_WIDTH__=64",
+	"__INTPTR_WIDTH__=64",
+
+	"__FLT_RADIX__=2",
+	"__FLT_EVAL_METHOD__=0",
+	"__FLT_MANT_DIG__=24",
+	"__FLT_DIG__=6",
+	"__FLT_DECIMAL_DIG__=9",
+	"__FLT_MIN_EXP__=(-125)",
+	"__FLT_MIN_10_EXP__=(-37)",
+	"__FLT_MAX_EXP__=128",
+	"__FLT_MAX_10_EXP__=38",
+	"__FLT_MAX__=0x1.fffffep+127F",
+	"__FLT_MIN__=0x1p-126F",
+	"__FLT_EPSILON__=0x1p-23F",
+	"__FLT_DENORM_MIN__=0x1p-149F",
+	"__FLT_HAS_DENORM__",
+	"__FLT_HAS_INFINITY__",
+	"__FLT_HAS_QUIET_NAN__",
+	"__DBL_MANT_DIG__=53",
+	"__DBL_DIG__=15",
+	"__DBL_DECIMAL_DIG__=17",
+	"__DBL_MIN_EXP__=(-1021)",
+	"__DBL_MIN_10_EXP__=(-307)",
+	"__DBL_MAX_EXP__=1024",
+	"__DBL_MAX_10_EXP__=308",
+	"__DBL_MAX__=0x1.fffffffffffffp+1023",
+	"__DBL_MIN__=0x1p-1022",
+	"__DBL_EPSILON__=0x1p-52",
+	"__DBL_DENORM_MIN__=0x1p-1074",
+	"__DBL_HAS_DENORM__",
+	"__DBL_HAS_INFINITY__",
+	"__DBL_HAS_QUIET_NAN__",
+};
 
 /* check if two macro definitions are equal, as in C11 6.10.3p2 */
 static bool
@@ -74,7 +259,7 @@ macroequal(struct macro *m1, struct macro *m2)
 		if (m1->nparam != m2->nparam)
 			return false;
 		for (p1 = m1->param, p2 = m2->param; p1 < m1->param + m1->nparam; ++p1, ++p2) {
-			if (strcmp(p1->name, p2->name) != 0 || p1->flags != p2->flags)
+			if (p1->name != p2->name || p1->flags != p2->flags)
 				return false;
 		}
 	}
@@ -97,7 +282,7 @@ macroparam(struct macro *m, struct token *t)
 
 	if (t->kind == TIDENT) {
 		for (i = 0; i < m->nparam; ++i) {
-			if (strcmp(m->param[i].name, t->lit) == 0)
+			if (m->param[i].name == t->lit)
 				return i;
 		}
 	}
@@ -110,17 +295,27 @@ macroget(char *name)
 {
 	struct mapkey k;
 
-	mapkey(&k, name, strlen(name));
+	atomkey(&k, name);
 	return mapget(&macros, &k);
 }
 
 static void
 macrodone(struct macro *m)
 {
+	struct argregion *r;
+
 	m->hide = false;
 	if (m->kind == MACROFUNC && m->nparam > 0) {
-		free(m->arg[0].token);
-		free(m->arg);
+		r = (struct argregion *)argregions.val + m->region;
+		r->done = true;
+		/* a frame may be popped while a later invocation is still live */
+		while (argregions.len > 0) {
+			r = arraylast(&argregions, sizeof(*r));
+			if (!r->done)
+				break;
+			arenarestore(&argarena, &r->mark);
+			argregions.len -= sizeof(*r);
+		}
 	}
 	--macrodepth;
 }
@@ -172,7 +367,8 @@ again:
 	if (ctx.len == 0)
 		return NULL;
 	m = f->macro;
-	if (m && m->kind == MACROFUNC) {
+	/* the parameters of macros with '##' have already been replaced */
+	if (m && m->kind == MACROFUNC && !m->paste) {
 		/* try to expand macro parameter */
 		space = f->token->space;
 		switch (f->token->kind) {
@@ -194,7 +390,6 @@ again:
 			f = ctxpush(m->arg[i].token, m->arg[i].ntoken, NULL, space);
 			break;
 		}
-		/* XXX: token concatenation */
 	}
 	return framenext(f);
 }
@@ -214,6 +409,8 @@ define(void)
 	m = xmalloc(sizeof(*m));
 	m->name = tokencheck(&tok, TIDENT, "after #define");
 	m->hide = false;
+	m->paste = false;
+	m->subst = (struct array){0};
 	t = arrayadd(&repl, sizeof(*t));
 	scan(t);
 	if (t->kind == TLPAREN && !t->space) {
@@ -230,7 +427,7 @@ define(void)
 			p = arrayadd(&params, sizeof(*p));
 			p->flags = 0;
 			if (tok.kind == TELLIPSIS) {
-				p->name = "__VA_ARGS__";
+				p->name = vaargs;
 				p->flags |= PARAMVAR;
 			} else {
 				p->name = tokencheck(&tok, TIDENT, "of macro parameter name or '...'");
@@ -247,16 +444,17 @@ define(void)
 	i = macroparam(m, t);
 	while (t->kind != TNEWLINE && t->kind != TEOF) {
 		if (t->kind == THASHHASH)
-			error(&t->loc, "'##' operator is not yet implemented");
+			m->paste = true;
 		prev = t->kind;
 		t = arrayadd(&repl, sizeof(*t));
 		scan(t);
-		if (t->kind == TIDENT && strcmp(t->lit, "__VA_ARGS__") == 0 && !macrovarargs(m))
+		if (t->kind == TIDENT && t->lit == vaargs && !macrovarargs(m))
 			error(&t->loc, "__VA_ARGS__ can only be used in variadic function-like macros");
 		if (m->kind != MACROFUNC)
 			continue;
+		/* operands of '##' are not macro-expanded */
 		if (i != -1)
-			m->param[i].flags |= PARAMTOK;
+			m->param[i].flags |= t->kind == THASHHASH ? PARAMRAW : PARAMTOK;
 		i = macroparam(m, t);
 		if (prev == THASH) {
 			tokencheck(t, TIDENT, "after '#' operator");
@@ -264,13 +462,18 @@ define(void)
 				error(&t->loc, "'%s' is not a macro parameter name", t->lit);
 			m->param[i].flags |= PARAMSTR;
 			i = -1;
+		} else if (prev == THASHHASH && i != -1) {
+			m->param[i].flags |= PARAMRAW;
+			i = -1;
 		}
 	}
 	m->token = repl.val;
 	m->ntoken = repl.len / sizeof(*t) - 1;
 	tok = *t;
+	if (m->paste && (m->token[0].kind == THASHHASH || m->token[m->ntoken - 1].kind == THASHHASH))
+		error(&tok.loc, "'##' cannot appear at either end of a macro replacement list");
 
-	mapkey(&k, m->name, strlen(m->name));
+	atomkey(&k, m->name);
 	entry = mapput(&macros, &k);
 	if (*entry && !macroequal(m, *entry))
 		error(&tok.loc, "redefinition of macro '%s'", m->name);
@@ -286,11 +489,10 @@ undef(void)
 	struct macro *m;
 
 	name = tokencheck(&tok, TIDENT, "after #undef");
-	mapkey(&k, name, strlen(name));
+	atomkey(&k, name);
 	entry = mapput(&macros, &k);
 	m = *entry;
 	if (m) {
-		free(name);
 		free(m->param);
 		free(m->token);
 		*entry = NULL;
@@ -298,33 +500,906 @@ undef(void)
 	scan(&tok);
 }
 
+void
+ppadddir(enum ppdir kind, char *dir)
+{
+	arrayaddptr(&incdirs[kind], dir);
+}
+
+/* try to open a file in a directory, or relative to the working directory if the directory is empty */
+static FILE *
+ppopendir(const char *dir, size_t dirlen, const char *name, size_t namelen, const char *mode, char **path)
+{
+	FILE *f;
+	char *p;
+
+	p = xmalloc(dirlen + namelen + 2);
+	if (dirlen > 0) {
+		memcpy(p, dir, dirlen);
+		p[dirlen++] = '/';
+	}
+	memcpy(p + dirlen, name, namelen);
+	p[dirlen + namelen] = '\0';
+	f = fopen(p, mode);
+	if (f)
+		*path = p;
+	else
+		free(p);
+	return f;
+}
+
+/*
+6.10.2 Source file inclusion
+
+Open the header or resource with the given name, including its
+delimiters, returning NULL if it is not found. Quoted names are first
+looked up relative to the directory of the file containing the
+directive, regardless of where the tokens forming the name came from,
+and then in the -iquote directories. Both kinds of names are then
+looked up in the -I, -isystem, and -idirafter directories, in that
+order.
+
+On entry, *dir is the number of search directories to skip, as for
+#include_next. On return, it is the number of search directories up
+to and including the one the file was found in, or 0 if it was not
+found in a search directory.
+*/
+static FILE *
+ppopen(const char *name, const char *mode, char **path, size_t *dir)
+{
+	const char *file, *slash;
+	char **d;
+	enum ppdir kind, k;
+	size_t len, skip, n;
+	FILE *f;
+
+	kind = name[0] == '<' ? PPDIRINCLUDE : PPDIRQUOTE;
+	len = strlen(name) - 2;
+	++name;
+	skip = *dir;
+	*dir = 0;
+	if (name[0] == '/')
+		return ppopendir(NULL, 0, name, len, mode, path);
+	if (kind == PPDIRQUOTE && skip == 0) {
+		file = scanname();
+		slash = strrchr(file, '/');
+		f = ppopendir(file, slash ? slash - file : 0, name, len, mode, path);
+		if (f)
+			return f;
+	}
+	n = 0;
+	for (k = PPDIRQUOTE; k <= PPDIRAFTER; ++k) {
+		arrayforeach (&incdirs[k], d) {
+			if (++n <= skip || k < kind)
+				continue;
+			f = ppopendir(*d, strlen(*d), name, len, mode, path);
+			if (f) {
+				*dir = n;
+				return f;
+			}
+		}
+	}
+	return NULL;
+}
+
+static struct token *rawnext(void);
+static bool expand(struct token *);
+
+/* read a header name, either directly or formed from macro-expanded tokens */
+static char *
+headername(struct location *loc)
+{
+	struct array buf = {0};
+	struct token *t;
+	const char *lit;
+	char *name;
+
+	name = ctx.len == 0 ? scanheadername(loc) : NULL;
+	if (!name) {
+		/* tokens from macros may have no location, so use the first one */
+		t = rawnext();
+		*loc = t->loc;
+		while (expand(t))
+			t = rawnext();
+		switch (t->kind) {
+		case TSTRINGLIT:
+			arrayaddbuf(&buf, t->lit, strlen(t->lit) + 1);
+			break;
+		case TLESS:
+			arrayaddbuf(&buf, "<", 1);
+			for (;;) {
+				do t = rawnext();
+				while (expand(t));
+				if (t->kind == TGREATER)
+					break;
+				if (t->kind == TNEWLINE || t->kind == TEOF)
+					error(&t->loc, "expected '>' after header name");
+				if (t->space)
+					arrayaddbuf(&buf, " ", 1);
+				lit = t->lit ? t->lit : tokstr[t->kind];
+				arrayaddbuf(&buf, lit, strlen(lit));
+			}
+			arrayaddbuf(&buf, ">", 2);
+			break;
+		default:
+			error(loc, "expected header name");
+		}
+		name = buf.val;
+	}
+	if (strlen(name) == 2)
+		error(loc, "empty header name");
+	return name;
+}
+
+static bool
+isdynamic(char *name)
+{
+	return name == filemacro || name == linemacro || name == datemacro || name == timemacro;
+}
+
+static bool
+isdefined(char *name)
+{
+	return macroget(name) || name == hasinclude || isdynamic(name);
+}
+
+/* get the record for an included file */
+static struct incfile *
+incfile(const struct fileinfo *info, char *path)
+{
+	struct incfile *file;
+	struct fileid id;
+	struct mapkey k;
+
+	id.dev = info->dev;
+	id.ino = info->ino;
+	if (info->hasid)
+		mapkey(&k, &id, sizeof(id));
+	else
+		mapkey(&k, path, strlen(path));
+	file = mapget(&incfiles, &k);
+	if (!file) {
+		file = xmalloc(sizeof(*file));
+		file->id = id;
+		file->path = path;
+		file->mtime = info->mtime;
+		file->mtimensec = info->mtimensec;
+		file->size = info->size;
+		file->once = false;
+		file->guard = NULL;
+		/* the key must point to memory that lives as long as the map */
+		k.str = info->hasid ? (void *)&file->id : file->path;
+		*mapput(&incfiles, &k) = file;
+	}
+	return file;
+}
+
+/* get the guard detection state of the current file, if it was included */
+static struct include *
+guardstate(void)
+{
+	return includes.len ? arraylast(&includes, sizeof(struct include)) : NULL;
+}
+
+/* record the include guard of files that have been read to the end */
 static void
+includedone(void)
+{
+	struct include *s;
+
+	while ((s = guardstate()) && s->depth > scandepth()) {
+		s->file->guard = s->state == GUARDEND ? s->guard : NULL;
+		includes.len -= sizeof(*s);
+	}
+}
+
+/*
+Files that are marked with #pragma once, or whose contents are
+entirely inside an #ifndef group for a macro that is now defined, are
+skipped without being read again.
+
+#include_next continues the search after the directory that the
+current file was found in.
+*/
+static void
+include(bool next)
+{
+	enum { MAXINCLUDE = 200 };
+	struct include *s;
+	struct incfile *file;
+	struct location loc;
+	struct fileinfo info;
+	char *name, *path;
+	size_t dir;
+	FILE *f;
+
+	s = guardstate();
+	dir = next && s && s->depth == scandepth() ? s->dir : 0;
+	name = headername(&loc);
+	tok = *rawnext();
+	tokencheck(&tok, TNEWLINE, "after header name");
+	if (scandepth() > MAXINCLUDE)
+		error(&loc, "#include nested too deeply");
+	f = ppopen(name, "r", &path, &dir);
+	if (!f)
+		error(&loc, "header %s not found", name);
+	free(name);
+	fileinfo(f, path, &info);
+	file = incfile(&info, path);
+	if (file->once || file->guard && isdefined(file->guard)) {
+		fclose(f);
+		free(path);
+		return;
+	}
+	scanfrom(path, f);
+	s = arrayadd(&includes, sizeof(*s));
+	s->file = file;
+	s->depth = scandepth();
+	s->dir = dir;
+	s->state = GUARDSTART;
+	s->guard = NULL;
+}
+
+/* replace a defined operator and its operand with 0 or 1 */
+static struct token *
+ppdefined(struct token *t)
+{
+	static struct token result;
+	char *name;
+	bool paren;
+
+	result = *t;
+	result.kind = TNUMBER;
+	t = rawnext();
+	paren = t->kind == TLPAREN;
+	if (paren)
+		t = rawnext();
+	name = tokencheck(t, TIDENT, "after 'defined'");
+	result.lit = isdefined(name) ? "1" : "0";
+	if (paren)
+		tokencheck(rawnext(), TRPAREN, "after 'defined' operand");
+	return &result;
+}
+
+/* replace a __has_include expression with 0 or 1 */
+static struct token *
+pphasinclude(struct token *t)
+{
+	static struct token result;
+	struct location loc;
+	char *name, *path;
+	size_t dir;
+	FILE *f;
+
+	result = *t;
+	result.kind = TNUMBER;
+	tokencheck(rawnext(), TLPAREN, "after '__has_include'");
+	name = headername(&loc);
+	tokencheck(rawnext(), TRPAREN, "after header name");
+	dir = 0;
+	f = ppopen(name, "r", &path, &dir);
+	if (f) {
+		fclose(f);
+		free(path);
+	}
+	free(name);
+	result.lit = f ? "1" : "0";
+	return &result;
+}
+
+static struct ppval
+ppnumber(struct token *t)
+{
+	struct ppval v;
+	char *src, *end;
+	int base;
+
+	src = t->lit;
+	base = 0;
+	if (src[0] == '0' && (src[1] == 'b' || src[1] == 'B'))
+		src += 2, base = 2;
+	errno = 0;
+	v.val = strtoull(src, &end, base);
+	if (end == src)
+		error(&t->loc, "invalid integer constant '%s'", t->lit);
+	if (errno)
+		error(&t->loc, "integer constant '%s' is too large", t->lit);
+	v.issigned = v.val <= LLONG_MAX;
+	for (; *end; ++end) {
+		switch (*end) {
+		case 'u':
+		case 'U':
+			v.issigned = false;
+			break;
+		case 'l':
+		case 'L':
+			break;
+		default:
+			error(&t->loc, "invalid integer constant '%s' in preprocessor expression", t->lit);
+		}
+	}
+	return v;
+}
+
+static struct ppval ppcondexpr(struct token **, bool);
+
+static struct ppval
+ppunaryexpr(struct token **p, bool eval)
+{
+	struct token *t;
+	struct type *type;
+	struct ppval v;
+
+	t = (*p)++;
+	switch (t->kind) {
+	case TADD:
+		return ppunaryexpr(p, eval);
+	case TSUB:
+		v = ppunaryexpr(p, eval);
+		v.val = -v.val;
+		return v;
+	case TBNOT:
+		v = ppunaryexpr(p, eval);
+		v.val = ~v.val;
+		return v;
+	case TLNOT:
+		v = ppunaryexpr(p, eval);
+		v.val = !v.val;
+		v.issigned = true;
+		return v;
+	case TLPAREN:
+		v = ppcondexpr(p, eval);
+		tokencheck(*p, TRPAREN, "after expression");
+		++*p;
+		return v;
+	case TNUMBER:
+		return ppnumber(t);
+	case TCHARCONST:
+		v.val = charconstval(t, &type);
+		v.issigned = type->u.arith.issigned;
+		return v;
+	case TIDENT:
+		/* identifiers that remain after macro expansion are replaced with 0 */
+		v.val = strcmp(t->lit, "true") == 0;
+		v.issigned = true;
+		return v;
+	}
+	error(&t->loc, "expected expression in preprocessor conditional");
+}
+
+/* evaluate a binary operator with the usual arithmetic conversions of intmax_t and uintmax_t */
+static struct ppval
+ppbinary(struct token *op, struct ppval l, struct ppval r, bool eval)
+{
+	struct ppval v;
+	long long x, y;
+
+	x = l.val;
+	y = r.val;
+	v.issigned = l.issigned && r.issigned;
+	switch (op->kind) {
+	case TMUL:
+		v.val = l.val * r.val;
+		break;
+	case TDIV:
+	case TMOD:
+		if (r.val == 0) {
+			if (eval)
+				error(&op->loc, "division by zero in preprocessor expression");
+			v.val = 0;
+		} else if (!v.issigned) {
+			v.val = op->kind == TDIV ? l.val / r.val : l.val % r.val;
+		} else if (y == -1) {
+			/* avoid overflow of LLONG_MIN / -1 */
+			v.val = op->kind == TDIV ? -l.val : 0;
+		} else {
+			v.val = op->kind == TDIV ? x / y : x % y;
+		}
+		break;
+	case TADD:
+		v.val = l.val + r.val;
+		break;
+	case TSUB:
+		v.val = l.val - r.val;
+		break;
+	case TSHL:
+		v.issigned = l.issigned;
+		v.val = r.val < 64 ? l.val << r.val : 0;
+		break;
+	case TSHR:
+		v.issigned = l.issigned;
+		if (l.issigned)
+			v.val = x >> (r.val < 64 ? r.val : 63);
+		else
+			v.val = r.val < 64 ? l.val >> r.val : 0;
+		break;
+	case TLESS:
+		v.val = v.issigned ? x < y : l.val < r.val;
+		v.issigned = true;
+		break;
+	case TGREATER:
+		v.val = v.issigned ? x > y : l.val > r.val;
+		v.issigned = true;
+		break;
+	case TLEQ:
+		v.val = v.issigned ? x <= y : l.val <= r.val;
+		v.issigned = true;
+		break;
+	case TGEQ:
+		v.val = v.issigned ? x >= y : l.val >= r.val;
+		v.issigned = true;
+		break;
+	case TEQL:
+		v.val = l.val == r.val;
+		v.issigned = true;
+		break;
+	case TNEQ:
+		v.val = l.val != r.val;
+		v.issigned = true;
+		break;
+	case TBAND:
+		v.val = l.val & r.val;
+		break;
+	case TXOR:
+		v.val = l.val ^ r.val;
+		break;
+	case TBOR:
+		v.val = l.val | r.val;
+		break;
+	case TLAND:
+		v.val = l.val && r.val;
+		v.issigned = true;
+		break;
+	case TLOR:
+		v.val = l.val || r.val;
+		v.issigned = true;
+		break;
+	default:
+		fatal("internal error; unknown binary operator %d", op->kind);
+	}
+	return v;
+}
+
+static struct ppval
+ppbinaryexpr(struct token **p, struct ppval l, int i, bool eval)
+{
+	struct token *op;
+	struct ppval r;
+	bool reval;
+	int j, k;
+
+	while ((j = precedence((*p)->kind)) >= i) {
+		op = (*p)++;
+		/* the right operand of && and || may not be evaluated */
+		reval = eval && (op->kind == TLAND ? l.val : op->kind == TLOR ? !l.val : true);
+		r = ppunaryexpr(p, reval);
+		while ((k = precedence((*p)->kind)) > j)
+			r = ppbinaryexpr(p, r, k, reval);
+		l = ppbinary(op, l, r, eval);
+	}
+	return l;
+}
+
+static struct ppval
+ppcondexpr(struct token **p, bool eval)
+{
+	struct ppval v, l, r;
+
+	v = ppbinaryexpr(p, ppunaryexpr(p, eval), 0, eval);
+	if ((*p)->kind != TQUESTION)
+		return v;
+	++*p;
+	l = ppcondexpr(p, eval && v.val);
+	tokencheck(*p, TCOLON, "in conditional expression");
+	++*p;
+	r = ppcondexpr(p, eval && !v.val);
+	v = v.val ? l : r;
+	v.issigned = l.issigned && r.issigned;
+	return v;
+}
+
+/*
+6.10.1 Conditional inclusion
+
+Read and evaluate the rest of the line as the controlling expression
+of the given directive.
+*/
+static struct ppval
+ppexpr(const char *name)
+{
+	static struct array buf;
+	struct token *t, *p;
+	struct ppval v;
+
+	buf.len = 0;
+	for (;;) {
+		t = rawnext();
+		if (t->kind == TIDENT && t->lit == defined)
+			t = ppdefined(t);
+		else if (t->kind == TIDENT && t->lit == hasinclude)
+			t = pphasinclude(t);
+		else if (expand(t))
+			continue;
+		arrayaddbuf(&buf, t, sizeof(*t));
+		if (t->kind == TNEWLINE || t->kind == TEOF)
+			break;
+	}
+	tok = *t;
+	p = buf.val;
+	if (p->kind == TNEWLINE || p->kind == TEOF)
+		error(&p->loc, "expected expression after #%s", name);
+	v = ppcondexpr(&p, true);
+	if (p->kind != TNEWLINE && p->kind != TEOF)
+		error(&p->loc, "unexpected token after #%s expression", name);
+	return v;
+}
+
+enum condkind {
+	CONDNONE,
+	CONDIF,     /* #if, #ifdef, #ifndef */
+	CONDELIF,   /* #elif, #elifdef, #elifndef */
+	CONDELSE,
+	CONDENDIF,
+};
+
+static enum condkind
+condkind(const char *name)
+{
+	if (strcmp(name, "if") == 0 || strcmp(name, "ifdef") == 0 || strcmp(name, "ifndef") == 0)
+		return CONDIF;
+	if (strcmp(name, "elif") == 0 || strcmp(name, "elifdef") == 0 || strcmp(name, "elifndef") == 0)
+		return CONDELIF;
+	if (strcmp(name, "else") == 0)
+		return CONDELSE;
+	if (strcmp(name, "endif") == 0)
+		return CONDENDIF;
+	return CONDNONE;
+}
+
+/*
+evaluate the condition of an #if-like or #elif-like directive, setting
+macro to the operand of the #ifdef-like forms
+*/
+static bool
+condtest(const char *name, char **macro)
+{
+	bool def;
+
+	*macro = NULL;
+	if (strcmp(name, "if") == 0 || strcmp(name, "elif") == 0)
+		return ppexpr(name).val != 0;
+	def = !strstr(name, "ndef");
+	scan(&tok);
+	if (tok.kind != TIDENT)
+		error(&tok.loc, "expected identifier after #%s", name);
+	*macro = tok.lit;
+	def = isdefined(tok.lit) == def;
+	scan(&tok);
+	return def;
+}
+
+/* get the group continued or ended by a directive */
+static struct cond *
+condlast(const char *name)
+{
+	struct cond *c;
+
+	c = conds.len ? arraylast(&conds, sizeof(*c)) : NULL;
+	if (c && c->depth > scandepth())
+		error(&c->loc, "unterminated conditional directive");
+	if (!c || c->depth != scandepth())
+		error(&tok.loc, "#%s without #if", name);
+	return c;
+}
+
+/*
+skip a group that is not included, returning the name of the
+directive that ends it
+
+Only directive names are tokenized, so that the rest of the group is
+skipped without any macro expansion or token allocation.
+*/
+static char *
+skipgroup(struct cond *c)
+{
+	size_t depth;
+	bool bol;
+
+	depth = 0;
+	for (bol = true;; bol = tok.kind == TNEWLINE) {
+		if (!scanskip(bol))
+			error(&c->loc, "unterminated conditional directive");
+		scan(&tok);
+		if (tok.kind != TIDENT)
+			continue;
+		switch (condkind(tok.lit)) {
+		case CONDIF:
+			++depth;
+			break;
+		case CONDENDIF:
+			if (depth == 0)
+				return tok.lit;
+			--depth;
+			break;
+		case CONDELIF:
+		case CONDELSE:
+			if (depth == 0)
+				return tok.lit;
+			break;
+		}
+	}
+}
+
+static void
+conditional(char *name)
+{
+	struct include *s;
+	struct cond *c;
+	char *macro;
+	bool taken;
+
+	s = guardstate();
+	for (;;) {
+		switch (condkind(name)) {
+		case CONDIF:
+			c = arrayadd(&conds, sizeof(*c));
+			c->taken = false;
+			c->sawelse = false;
+			c->depth = scandepth();
+			c->loc = tok.loc;
+			taken = condtest(name, &macro);
+			if (s && s->state == GUARDSTART) {
+				if (macro && strcmp(name, "ifndef") == 0) {
+					s->state = GUARDIN;
+					s->guard = macro;
+					s->cond = conds.len / sizeof(*c) - 1;
+				} else {
+					s->state = GUARDNONE;
+				}
+			}
+			break;
+		case CONDELIF:
+			c = condlast(name);
+			if (c->sawelse)
+				error(&tok.loc, "#%s after #else", name);
+			if (s && s->state == GUARDIN && s->cond == conds.len / sizeof(*c) - 1)
+				s->state = GUARDNONE;
+			if (c->taken) {
+				/* the condition is not evaluated */
+				do scan(&tok);
+				while (tok.kind != TNEWLINE && tok.kind != TEOF);
+				taken = false;
+			} else {
+				taken = condtest(name, &macro);
+			}
+			break;
+		case CONDELSE:
+			c = condlast(name);
+			if (c->sawelse)
+				error(&tok.loc, "#else after #else");
+			if (s && s->state == GUARDIN && s->cond == conds.len / sizeof(*c) - 1)
+				s->state = GUARDNONE;
+			c->sawelse = true;
+			scan(&tok);
+			taken = !c->taken;
+			break;
+		case CONDENDIF:
+			condlast(name);
+			conds.len -= sizeof(*c);
+			if (s && s->state == GUARDIN && s->cond == conds.len / sizeof(*c))
+				s->state = GUARDEND;
+			scan(&tok);
+			return;
+		default:
+			assert(0);
+		}
+		if (taken) {
+			c->taken = true;
+			return;
+		}
+		tokencheck(&tok, TNEWLINE, "after preprocessing directive");
+		name = skipgroup(c);
+	}
+}
+
+/* read the balanced token sequence of an #embed parameter */
+static void
+embedparam(struct array *param, const char *name)
+{
+	struct token *t;
+	size_t depth;
+
+	if (param->val)
+		error(&tok.loc, "duplicate #embed parameter '%s'", name);
+	scan(&tok);
+	tokencheck(&tok, TLPAREN, "after #embed parameter");
+	/* keep the array non-NULL even if the sequence is empty */
+	arrayadd(param, sizeof(*t));
+	param->len = 0;
+	for (depth = 0;; arrayaddbuf(param, &tok, sizeof(tok))) {
+		scan(&tok);
+		switch (tok.kind) {
+		case TLPAREN:
+			++depth;
+			break;
+		case TRPAREN:
+			if (depth-- == 0) {
+				scan(&tok);
+				return;
+			}
+			break;
+		case TNEWLINE:
+		case TEOF:
+			error(&tok.loc, "unterminated #embed parameter '%s'", name);
+		}
+	}
+}
+
+/*
+6.10.4 Binary resource inclusion
+
+Push the tokens that replace the directive, returning whether there
+are any. The data is kept in a single TEMBED token rather than a token
+per byte, so that initializers of character arrays can use it directly.
+*/
+static bool
+embed(void)
+{
+	struct array prefix = {0}, suffix = {0}, ifempty = {0}, limit = {0}, out = {0};
+	struct location loc;
+	struct stringlit *data;
+	struct token *t;
+	struct ppval val;
+	struct fileinfo info;
+	unsigned long long max;
+	unsigned char *buf;
+	char *name, *param, *path;
+	size_t len, cap, n, dir;
+	FILE *f;
+
+	name = scanheadername(&loc);
+	if (!name)
+		error(&tok.loc, "expected header name after #embed");
+	scan(&tok);
+	while (tok.kind != TNEWLINE && tok.kind != TEOF) {
+		param = tokencheck(&tok, TIDENT, "for #embed parameter");
+		if (strcmp(param, "limit") == 0 || strcmp(param, "__limit__") == 0)
+			embedparam(&limit, "limit");
+		else if (strcmp(param, "prefix") == 0 || strcmp(param, "__prefix__") == 0)
+			embedparam(&prefix, "prefix");
+		else if (strcmp(param, "suffix") == 0 || strcmp(param, "__suffix__") == 0)
+			embedparam(&suffix, "suffix");
+		else if (strcmp(param, "if_empty") == 0 || strcmp(param, "__if_empty__") == 0)
+			embedparam(&ifempty, "if_empty");
+		else
+			error(&tok.loc, "unsupported #embed parameter '%s'", param);
+	}
+	max = -1;
+	if (limit.val) {
+		/* evaluate the limit like the expression of #if */
+		arrayaddbuf(&limit, &tok, sizeof(tok));
+		ctxpush(limit.val, limit.len / sizeof(tok), NULL, false);
+		val = ppexpr("embed limit");
+		if (val.issigned && (long long)val.val < 0)
+			error(&loc, "#embed limit must not be negative");
+		max = val.val;
+	}
+
+	dir = 0;
+	f = ppopen(name, "rb", &path, &dir);
+	if (!f)
+		error(&loc, "resource %s not found", name);
+	/* record the resource so that precompiled headers depend on it */
+	fileinfo(f, path, &info);
+	incfile(&info, path);
+	buf = NULL;
+	len = 0;
+	cap = 0;
+	while (len < max) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 1<<12;
+			buf = xreallocarray(buf, cap, 1);
+		}
+		n = fread(buf + len, 1, cap - len < max - len ? cap - len : max - len, f);
+		if (n == 0) {
+			if (ferror(f))
+				fatal("read %s:", path);
+			break;
+		}
+		len += n;
+	}
+	fclose(f);
+	free(name);
+
+	if (len == 0) {
+		free(buf);
+		arrayaddbuf(&out, ifempty.val, ifempty.len);
+	} else {
+		arrayaddbuf(&out, prefix.val, prefix.len);
+		data = xmalloc(sizeof(*data));
+		data->size = len;
+		data->data = buf;
+		t = arrayadd(&out, sizeof(*t));
+		t->kind = TEMBED;
+		t->hide = false;
+		t->space = true;
+		t->loc = loc;
+		t->lit = (char *)data;
+		arrayaddbuf(&out, suffix.val, suffix.len);
+	}
+	free(prefix.val);
+	free(suffix.val);
+	free(ifempty.val);
+	if (out.len == 0)
+		return false;
+	/* keep the line break of the directive */
+	arrayaddbuf(&out, &tok, sizeof(tok));
+	ctxpush(out.val, out.len / sizeof(*t), NULL, true);
+	return true;
+}
+
+/* replace the current TEMBED token with integer constants separated by commas */
+void
+expandembed(void)
+{
+	static char lit[256][4];
+	struct stringlit *data;
+	struct token *t;
+	size_t i;
+
+	assert(tok.kind == TEMBED);
+	if (!lit[1][0]) {
+		for (i = 0; i < 256; ++i)
+			snprintf(lit[i], sizeof(lit[i]), "%zu", i);
+	}
+	data = (struct stringlit *)tok.lit;
+	t = xreallocarray(NULL, data->size * 2 - 1, sizeof(*t));
+	for (i = 0; i < data->size; ++i) {
+		if (i > 0) {
+			t[2 * i - 1] = tok;
+			t[2 * i - 1].kind = TCOMMA;
+			t[2 * i - 1].space = false;
+			t[2 * i - 1].lit = NULL;
+		}
+		t[2 * i] = tok;
+		t[2 * i].kind = TNUMBER;
+		t[2 * i].space = i > 0;
+		t[2 * i].lit = lit[((unsigned char *)data->data)[i]];
+	}
+	ctxpush(t, data->size * 2 - 1, NULL, tok.space);
+	next();
+}
+
+static bool
 directive(void)
 {
-	struct location newloc;
+	struct location loc, newloc;
+	struct include *s;
+	struct token *t;
 	enum ppflags oldflags;
-	char *name = NULL;
+	char *name = NULL, *text;
+	bool pushed = false;
 
 	scan(&tok);
 	if (tok.kind == TNEWLINE)
-		return;  /* empty directive */
+		return false;  /* empty directive */
 	oldflags = ppflags;
 	ppflags |= PPNEWLINE;
+	indirective = true;
 	if (tok.kind == TNUMBER)
 		goto line;  /* gcc line markers */
 	name = tokencheck(&tok, TIDENT, "newline, or number after '#'");
-	if (strcmp(name, "if") == 0) {
-		error(&tok.loc, "#if directive is not implemented");
-	} else if (strcmp(name, "ifdef") == 0) {
-		error(&tok.loc, "#ifdef directive is not implemented");
-	} else if (strcmp(name, "ifndef") == 0) {
-		error(&tok.loc, "#ifndef directive is not implemented");
-	} else if (strcmp(name, "elif") == 0) {
-		error(&tok.loc, "#elif directive is not implemented");
-	} else if (strcmp(name, "endif") == 0) {
-		error(&tok.loc, "#endif directive is not implemented");
+	s = guardstate();
+	if (s && (s->state == GUARDSTART && strcmp(name, "ifndef") != 0 || s->state == GUARDEND))
+		s->state = GUARDNONE;
+	if (condkind(name) != CONDNONE) {
+		conditional(name);
 	} else if (strcmp(name, "include") == 0) {
-		error(&tok.loc, "#include directive is not implemented");
+		include(false);
+	} else if (strcmp(name, "include_next") == 0) {
+		include(true);
+	} else if (strcmp(name, "embed") == 0) {
+		pushed = embed();
 	} else if (strcmp(name, "define") == 0) {
 		scan(&tok);
 		define();
@@ -355,16 +1430,32 @@ line:
 			scan(&tok);
 		scansetloc(newloc);
 	} else if (strcmp(name, "error") == 0) {
-		error(&tok.loc, "#error directive is not implemented");
+		loc = tok.loc;
+		error(&loc, "#error %s", scanline());
+	} else if (strcmp(name, "warning") == 0) {
+		loc = tok.loc;
+		text = scanline();
+		warning(&loc, "#warning %s", text);
+		free(text);
+		scan(&tok);
 	} else if (strcmp(name, "pragma") == 0) {
+		scan(&tok);
+		if (tok.kind == TIDENT && strcmp(tok.lit, "once") == 0 && s)
+			s->file->once = true;
 		while (tok.kind != TNEWLINE && tok.kind != TEOF)
 			next();
 	} else {
 		error(&tok.loc, "invalid preprocessor directive #%s", name);
 	}
-	free(name);
 	tokencheck(&tok, TNEWLINE, "after preprocessing directive");
+	if (!pushed) {
+		/* finish the expansion of any macros used in the directive */
+		t = ctxnext();
+		assert(!t);
+	}
 	ppflags = oldflags;
+	indirective = false;
+	return pushed;
 }
 
 /* get the next token without expanding it */
@@ -372,13 +1463,34 @@ static void
 nextinto(struct token *t)
 {
 	static bool newline = true;
+	struct include *s;
+	struct cond *c;
+	bool pushed;
 
 	for (;;) {
 		scan(t);
+		if (includes.len)
+			includedone();
 		if (newline && t->kind == THASH) {
-			directive();
+			newline = false;
+			pushed = directive();
+			newline = true;
+			/* #embed pushes its replacement tokens to the context */
+			if (pushed) {
+				*t = *ctxnext();
+				break;
+			}
 		} else {
-			newline = tok.kind == TNEWLINE;
+			if (t->kind == TEOF && conds.len) {
+				c = arraylast(&conds, sizeof(*c));
+				error(&c->loc, "unterminated conditional directive");
+			}
+			newline = t->kind == TNEWLINE;
+			if (!newline && includes.len) {
+				s = guardstate();
+				if (s->state != GUARDIN)
+					s->state = GUARDNONE;
+			}
 			break;
 		}
 	}
@@ -400,7 +1512,8 @@ rawnext(void)
 static bool
 peekparen(void)
 {
-	static struct array pending;
+	static struct array pending, dirpending;
+	struct array *p;
 	struct token *t;
 	struct frame *f;
 
@@ -413,22 +1526,24 @@ peekparen(void)
 		++f->ntoken;
 		return false;
 	}
-	pending.len = 0;
-	do t = arrayadd(&pending, sizeof(*t)), nextinto(t);
-	while (t->kind == TNEWLINE);
+	/* a directive may be read while looking for the parenthesis of an invocation outside of one */
+	p = indirective ? &dirpending : &pending;
+	p->len = 0;
+	do t = arrayadd(p, sizeof(*t)), nextinto(t);
+	while (t->kind == TNEWLINE && !indirective);
 	if (t->kind == TLPAREN)
 		return true;
-	t = pending.val;
-	ctxpush(t, pending.len / sizeof(*t), NULL, t[0].space);
+	t = p->val;
+	ctxpush(t, p->len / sizeof(*t), NULL, t[0].space);
 	return false;
 }
 
 static void
-stringize(struct array *buf, struct token *t)
+stringize(struct array *buf, size_t base, struct token *t)
 {
 	const char *lit;
 
-	if ((t->space || t->kind == TNEWLINE) && buf->len > 1 && ((char *)buf->val)[buf->len - 1] != ' ')
+	if ((t->space || t->kind == TNEWLINE) && buf->len > base + 1 && ((char *)buf->val)[buf->len - 1] != ' ')
 		arrayaddbuf(buf, " ", 1);
 	lit = t->lit ? t->lit : tokstr[t->kind];
 	if (t->kind == TSTRINGLIT || t->kind == TCHARCONST) {
@@ -442,82 +1557,278 @@ stringize(struct array *buf, struct token *t)
 	}
 }
 
+static bool
+isidentchar(int c)
+{
+	return c == '_' || isalnum(c) || c >= 0x80;
+}
+
+/* check whether a spelling forms a single preprocessing number */
+static bool
+isppnumber(const unsigned char *s)
+{
+	if (*s == '.')
+		++s;
+	if (!isdigit(*s))
+		return false;
+	for (++s; *s; ++s) {
+		if ((*s == '+' || *s == '-') && strchr("eEpP", s[-1]))
+			continue;
+		if (*s != '.' && !isidentchar(*s))
+			return false;
+	}
+	return true;
+}
+
+/*
+6.10.5.3 The ## operator
+
+Replace the left token with the concatenation of the two tokens. The
+result is classified from its spelling without rescanning it, using
+the interned punctuator table for anything that is not an identifier,
+number, or prefixed literal.
+*/
+static void
+paste(struct token *l, const struct token *r, const struct location *loc)
+{
+	static struct array buf;
+	const char *llit, *rlit;
+	unsigned char *s;
+	size_t n, i;
+	int kind;
+
+	if (l->kind == TEMBED || r->kind == TEMBED)
+		error(loc, "#embed data cannot be an operand of '##'");
+	llit = l->lit ? l->lit : tokstr[l->kind];
+	rlit = r->lit ? r->lit : tokstr[r->kind];
+	buf.len = 0;
+	arrayaddbuf(&buf, llit, strlen(llit));
+	arrayaddbuf(&buf, rlit, strlen(rlit) + 1);
+	s = buf.val;
+	n = buf.len - 1;
+	for (i = 0; i < n && isidentchar(s[i]); ++i)
+		;
+	if (i == n && !isdigit(s[0])) {
+		kind = TIDENT;
+	} else if (isppnumber(s)) {
+		kind = TNUMBER;
+	} else if ((r->kind == TSTRINGLIT || r->kind == TCHARCONST) && (*rlit == '"' || *rlit == '\'')
+	        && (strcmp(llit, "L") == 0 || strcmp(llit, "u") == 0 || strcmp(llit, "U") == 0 || strcmp(llit, "u8") == 0)) {
+		kind = r->kind;
+	} else {
+		kind = *atomdata(intern((char *)s, n));
+		if (kind == 0 || kind == TIDENT)
+			error(loc, "pasting '%s' and '%s' does not give a valid preprocessing token", llit, rlit);
+		l->kind = kind;
+		l->lit = NULL;
+		l->hide = false;
+		return;
+	}
+	l->kind = kind;
+	l->lit = intern((char *)s, n);
+	l->hide = false;
+}
+
+/*
+replace the parameters of a macro containing '##', and perform the
+concatenations, into the substitution buffer of the macro
+
+This buffer is not used again until the macro is done, since it is
+ineligible for expansion until then.
+*/
+static void
+pastesubst(struct macro *m)
+{
+	struct token *t, *end, *repl, *op;
+	bool raw, space, empty;
+	size_t i, n;
+
+	m->subst.len = 0;
+	/* whether the last operand was empty (a placemarker) */
+	empty = true;
+	for (t = m->token, end = t + m->ntoken; t < end;) {
+		op = t->kind == THASHHASH ? t++ : NULL;
+		space = t->space;
+		repl = t;
+		n = 1;
+		if (m->kind == MACROFUNC && t->kind == THASH) {
+			i = macroparam(m, ++t);
+			repl = &m->arg[i].str;
+		} else if (m->kind == MACROFUNC && (i = macroparam(m, t)) != -1) {
+			raw = op || t + 1 < end && t[1].kind == THASHHASH;
+			repl = raw ? m->arg[i].raw : m->arg[i].token;
+			n = raw ? m->arg[i].nraw : m->arg[i].ntoken;
+		}
+		if (n > 0) {
+			if (op && !empty) {
+				paste(arraylast(&m->subst, sizeof(*t)), repl, &op->loc);
+			} else {
+				arrayaddbuf(&m->subst, repl, sizeof(*t));
+				((struct token *)arraylast(&m->subst, sizeof(*t)))->space = space;
+			}
+			if (n > 1)
+				arrayaddbuf(&m->subst, repl + 1, (n - 1) * sizeof(*t));
+			empty = false;
+		} else if (!op) {
+			empty = true;
+		}
+		++t;
+	}
+}
+
+/*
+Get the replacement of __FILE__, __LINE__, __DATE__, or __TIME__. In
+the replacement list of a macro, the location is that of the name of
+the outermost macro invocation.
+*/
+static struct token *
+ppdynamic(struct token *t)
+{
+	static struct token result;
+	static struct array buf;
+	static char date[16], clock[16];
+	const struct location *loc;
+	const char *s;
+	char num[32];
+	time_t now;
+	struct tm *tm;
+
+	result = *t;
+	result.kind = TSTRINGLIT;
+	loc = macrodepth > 0 ? &exploc : &t->loc;
+	if (t->lit == linemacro) {
+		result.kind = TNUMBER;
+		snprintf(num, sizeof(num), "%zu", loc->line);
+		result.lit = intern(num, strlen(num));
+	} else if (t->lit == filemacro) {
+		buf.len = 0;
+		arrayaddbuf(&buf, "\"", 1);
+		for (s = loc->file; *s; ++s) {
+			if (*s == '\\' || *s == '"')
+				arrayaddbuf(&buf, "\\", 1);
+			arrayaddbuf(&buf, s, 1);
+		}
+		arrayaddbuf(&buf, "\"", 1);
+		result.lit = intern(buf.val, buf.len);
+	} else {
+		if (!date[0]) {
+			now = time(NULL);
+			tm = localtime(&now);
+			if (!tm || !strftime(date, sizeof(date), "\"%b %e %Y\"", tm) || !strftime(clock, sizeof(clock), "\"%H:%M:%S\"", tm)) {
+				strcpy(date, "\"Jan  1 1970\"");
+				strcpy(clock, "\"00:00:00\"");
+			}
+		}
+		result.lit = t->lit == datemacro ? date : clock;
+	}
+	return &result;
+}
+
 static void expandfunc(struct macro *);
 
 static bool
 expand(struct token *t)
 {
+	struct location loc;
+	struct token old;
 	struct macro *m;
 	bool space;
 
 	if (t->kind != TIDENT)
 		return false;
 	m = macroget(t->lit);
+	if (!m && !t->hide && isdynamic(t->lit)) {
+		ctxpush(ppdynamic(t), 1, NULL, t->space);
+		return true;
+	}
 	if (!m || m->hide)
 		t->hide = true;
 	if (t->hide)
 		return false;
 	space = t->space;
+	loc = t->loc;
 	if (m->kind == MACROFUNC) {
-		if (!peekparen())
+		/* directives read while looking for the parenthesis may overwrite tok */
+		old = *t;
+		if (!peekparen()) {
+			*t = old;
 			return false;
+		}
 		expandfunc(m);
 	}
-	ctxpush(m->token, m->ntoken, m, space);
+	if (macrodepth == 0)
+		exploc = loc;
+	if (m->paste) {
+		pastesubst(m);
+		ctxpush(m->subst.val, m->subst.len / sizeof(*t), m, space);
+	} else {
+		ctxpush(m->token, m->ntoken, m, space);
+	}
 	m->hide = true;
 	++macrodepth;
 	return true;
 }
 
+/* move the top of an argument stack to dst */
+static void *
+argmove(void *dst, struct array *buf, size_t base)
+{
+	size_t len;
+
+	len = buf->len - base;
+	if (len > 0)
+		memcpy(dst, (char *)buf->val + base, len);
+	buf->len = base;
+	return (char *)dst + len;
+}
+
 static void
 expandfunc(struct macro *m)
 {
+	static struct token eof = {.kind = TEOF};
 	struct macroparam *p;
 	struct macroarg *arg;
-	struct array str, tok;
-	size_t i, depth, paren;
+	struct argregion *r;
+	size_t i, region, paren, nraw, ntoken;
+	size_t argbase, tokbase, rawbase, strbase;
 	struct token *t;
 
-	/* read macro arguments */
+	/* read the macro arguments without expanding them */
 	paren = 0;
-	depth = macrodepth;
-	tok = (struct array){0};
-	arg = xreallocarray(NULL, m->nparam, sizeof(*arg));
+	argbase = argstack.len;
+	rawbase = argraws.len;
+	strbase = argstrs.len;
 	t = rawnext();
 	for (i = 0; i < m->nparam; ++i) {
 		p = &m->param[i];
-		if (p->flags & PARAMSTR) {
-			str = (struct array){0};
-			arrayaddbuf(&str, "\"", 1);
-		}
-		arg[i].ntoken = 0;
+		if (p->flags & PARAMSTR)
+			arrayaddbuf(&argstrs, "\"", 1);
+		nraw = 0;
 		for (;;) {
 			if (t->kind == TEOF)
 				error(&t->loc, "EOF when reading macro parameters");
-			if (macrodepth <= depth) {
-				/* adjust current macro depth, in case it got shallower */
-				depth = macrodepth;
-				if (paren == 0 && (t->kind == TRPAREN || t->kind == TCOMMA && !(p->flags & PARAMVAR)))
-					break;
-				switch (t->kind) {
-				case TLPAREN: ++paren; break;
-				case TRPAREN: --paren; break;
-				}
-				if (p->flags & PARAMSTR)
-					stringize(&str, t);
-			}
-			if (p->flags & PARAMTOK && !expand(t)) {
-				arrayaddbuf(&tok, t, sizeof(*t));
-				++arg[i].ntoken;
+			if (paren == 0 && (t->kind == TRPAREN || t->kind == TCOMMA && !(p->flags & PARAMVAR)))
+				break;
+			switch (t->kind) {
+			case TLPAREN: ++paren; break;
+			case TRPAREN: --paren; break;
 			}
+			if (p->flags & PARAMSTR)
+				stringize(&argstrs, strbase, t);
+			arrayaddbuf(&argraws, t, sizeof(*t));
+			++nraw;
 			t = rawnext();
 		}
+		arg = arrayadd(&argstack, sizeof(*arg));
+		arg->nraw = nraw;
 		if (p->flags & PARAMSTR) {
-			arrayaddbuf(&str, "\"", 2);
-			arg[i].str = (struct token){
+			/* the string may outlive the invocation, so it is interned */
+			arrayaddbuf(&argstrs, "\"", 1);
+			arg->str = (struct token){
 				.kind = TSTRINGLIT,
-				.lit = str.val,
+				.lit = intern((char *)argstrs.val + strbase, argstrs.len - strbase),
 			};
+			argstrs.len = strbase;
 		}
 		if (t->kind == TRPAREN)
 			break;
@@ -527,38 +1838,77 @@ expandfunc(struct macro *m)
 		error(&t->loc, "not enough arguments for macro '%s'", m->name);
 	if (t->kind != TRPAREN)
 		error(&t->loc, "too many arguments for macro '%s'", m->name);
-	for (i = 0, t = tok.val; i < m->nparam; ++i) {
+	if (m->nparam == 0)
+		return;
+	eof.loc = t->loc;
+
+	/* copy the arguments to storage released when the frame is popped */
+	r = arrayadd(&argregions, sizeof(*r));
+	r->mark = argarena;
+	r->done = false;
+	region = argregions.len / sizeof(*r) - 1;
+	arg = arenaalloc(&argarena, argstack.len - argbase + argraws.len - rawbase);
+	t = argmove(arg, &argstack, argbase);
+	for (i = 0; i < m->nparam; ++i) {
+		arg[i].raw = t;
+		t += arg[i].nraw;
+	}
+	argmove(arg[0].raw, &argraws, rawbase);
+
+	/*
+	fully expand each argument as if it formed the rest of the file,
+	with an end-of-file token, located at the closing parenthesis,
+	below it so that no invocation within it reads past its end
+	*/
+	tokbase = argtoks.len;
+	for (i = 0; i < m->nparam; ++i) {
+		ntoken = 0;
+		if (m->param[i].flags & PARAMTOK) {
+			ctxpush(&eof, 1, NULL, false);
+			if (arg[i].nraw > 0)
+				ctxpush(arg[i].raw, arg[i].nraw, NULL, arg[i].raw[0].space);
+			while ((t = rawnext())->kind != TEOF) {
+				if (!expand(t)) {
+					arrayaddbuf(&argtoks, t, sizeof(*t));
+					++ntoken;
+				}
+			}
+			/* the end-of-file frame is now on top */
+			ctx.len -= sizeof(struct frame);
+		}
+		arg[i].ntoken = ntoken;
+	}
+	/* nested invocations in the arguments have released their regions */
+	assert(argregions.len / sizeof(*r) == region + 1);
+	t = arenaalloc(&argarena, argtoks.len - tokbase);
+	for (i = 0; i < m->nparam; ++i) {
 		arg[i].token = t;
 		t += arg[i].ntoken;
 	}
+	argmove(arg[0].token, &argtoks, tokbase);
 	m->arg = arg;
+	m->region = region;
 }
 
+/* mark the interned names of keywords with their token kind */
 static void
-keyword(struct token *tok)
+keywordinit(void)
 {
 	static const struct {
 		const char *name;
 		int value;
 	} keywords[] = {
+#define TOKEN(t, s) {s, t},
+#include "tokens.h"
+#undef TOKEN
+		/* alternate spellings */
 		{"_Alignas",       TALIGNAS},
 		{"_Alignof",       TALIGNOF},
-		{"_Atomic",        T_ATOMIC},
-		{"_BitInt",        T_BITINT},
 		{"_Bool",          TBOOL},
-		{"_Complex",       T_COMPLEX},
-		{"_Decimal128",    T_DECIMAL128},
-		{"_Decimal32",     T_DECIMAL32},
-		{"_Decimal64",     T_DECIMAL64},
-		{"_Generic",       T_GENERIC},
-		{"_Imaginary",     T_IMAGINARY},
-		{"_Noreturn",      T_NORETURN},
 		{"_Static_assert", TSTATIC_ASSERT},
 		{"_Thread_local",  TTHREAD_LOCAL},
 		{"__alignof__",    TALIGNOF},
 		{"__asm",          T__ASM__},
-		{"__asm__",        T__ASM__},
-		{"__attribute__",  T__ATTRIBUTE__},
 		{"__inline",       TINLINE},
 		{"__inline__",     TINLINE},
 		{"__signed",       TSIGNED},
@@ -567,68 +1917,294 @@ keyword(struct token *tok)
 		{"__typeof",       TTYPEOF},
 		{"__typeof__",     TTYPEOF},
 		{"__volatile__",   TVOLATILE},
-		{"alignas",        TALIGNAS},
-		{"alignof",        TALIGNOF},
-		{"auto",           TAUTO},
-		{"bool",           TBOOL},
-		{"break",          TBREAK},
-		{"case",           TCASE},
-		{"char",           TCHAR},
-		{"const",          TCONST},
-		{"constexpr",      TCONSTEXPR},
-		{"continue",       TCONTINUE},
-		{"default",        TDEFAULT},
-		{"do",             TDO},
-		{"double",         TDOUBLE},
-		{"else",           TELSE},
-		{"enum",           TENUM},
-		{"extern",         TEXTERN},
-		{"false",          TFALSE},
-		{"float",          TFLOAT},
-		{"for",            TFOR},
-		{"goto",           TGOTO},
-		{"if",             TIF},
-		{"inline",         TINLINE},
-		{"int",            TINT},
-		{"long",           TLONG},
-		{"nullptr",        TNULLPTR},
-		{"register",       TREGISTER},
-		{"restrict",       TRESTRICT},
-		{"return",         TRETURN},
-		{"short",          TSHORT},
-		{"signed",         TSIGNED},
-		{"sizeof",         TSIZEOF},
-		{"static",         TSTATIC},
-		{"static_assert",  TSTATIC_ASSERT},
-		{"struct",         TSTRUCT},
-		{"switch",         TSWITCH},
-		{"thread_local",   TTHREAD_LOCAL},
-		{"true",           TTRUE},
-		{"typedef",        TTYPEDEF},
-		{"typeof",         TTYPEOF},
-		{"typeof_unqual",  TTYPEOF_UNQUAL},
-		{"union",          TUNION},
-		{"unsigned",       TUNSIGNED},
-		{"void",           TVOID},
-		{"volatile",       TVOLATILE},
-		{"while",          TWHILE},
 	};
-	size_t low = 0, high = countof(keywords), mid;
-	int cmp;
-
-	while (low < high) {
-		mid = (low + high) / 2;
-		cmp = strcmp(tok->lit, keywords[mid].name);
-		if (cmp == 0) {
-			free(tok->lit);
-			tok->kind = keywords[mid].value;
-			tok->lit = NULL;
-			break;
+	const char *name;
+	size_t i;
+
+	/* punctuators are also marked, to classify the results of '##' */
+	for (i = 0; i < countof(keywords); ++i) {
+		name = keywords[i].name;
+		if (name)
+			*atomdata(intern(name, strlen(name))) = keywords[i].value;
+	}
+}
+
+/* precompiled headers */
+
+enum {
+	PCHSPACE = 1<<0,  /* the token is preceded by a space */
+	PCHFILE  = 1<<1,  /* the token is from a different file than the previous one */
+};
+
+static void
+pchputtoken(struct pchwriter *w, const struct token *t)
+{
+	struct stringlit *data;
+
+	pchputint(&w->body, t->kind);
+	pchputint(&w->body, (t->space ? PCHSPACE : 0) | (t->loc.file != w->file ? PCHFILE : 0));
+	/* locations only store the file name when it changes */
+	if (t->loc.file != w->file) {
+		w->file = t->loc.file;
+		pchputref(w, w->file);
+	}
+	pchputint(&w->body, t->loc.line);
+	pchputint(&w->body, t->loc.col);
+	if (t->kind == TEMBED) {
+		data = (struct stringlit *)t->lit;
+		pchputint(&w->body, data->size);
+		arrayaddbuf(&w->body, data->data, data->size);
+	} else {
+		pchputref(w, t->lit);
+	}
+}
+
+/* record a file that the header depends on, so it can be loaded from any directory */
+static void
+pchputfile(struct array *buf, const char *path, unsigned long long mtime, unsigned long long mtimensec, unsigned long long size)
+{
+	char *abs;
+
+	abs = fullpath(path);
+	pchputstr(buf, abs);
+	free(abs);
+	pchputint(buf, mtime);
+	pchputint(buf, mtimensec);
+	pchputint(buf, size);
+}
+
+/* write the files read so far and the macros defined at the end of the input */
+void
+ppwritepch(struct pchwriter *w, const char *input)
+{
+	struct incfile *file;
+	struct macro *m;
+	struct fileinfo info;
+	size_t i, n;
+
+	n = 0;
+	for (i = 0; i < incfiles.cap; ++i)
+		n += incfiles.keys[i].str != NULL;
+	pchputint(&w->head, n + (input != NULL));
+	if (input) {
+		if (!pathinfo(input, &info))
+			fatal("stat %s:", input);
+		pchputfile(&w->head, input, info.mtime, info.mtimensec, info.size);
+		/* the header has already been included wherever the precompiled header is */
+		pchputint(&w->head, 1);
+		pchputstr(&w->head, NULL);
+	}
+	for (i = 0; i < incfiles.cap; ++i) {
+		if (!incfiles.keys[i].str)
+			continue;
+		file = incfiles.vals[i];
+		pchputfile(&w->head, file->path, file->mtime, file->mtimensec, file->size);
+		pchputint(&w->head, file->once);
+		pchputstr(&w->head, file->guard);
+	}
+
+	n = 0;
+	for (i = 0; i < macros.cap; ++i)
+		n += macros.keys[i].str && macros.vals[i];
+	pchputint(&w->body, n);
+	for (i = 0; i < macros.cap; ++i) {
+		m = macros.keys[i].str ? macros.vals[i] : NULL;
+		if (!m)
+			continue;
+		pchputref(w, m->name);
+		pchputint(&w->body, m->kind);
+		pchputint(&w->body, m->nparam);
+		for (n = 0; n < m->nparam; ++n) {
+			pchputref(w, m->param[n].name);
+			pchputint(&w->body, m->param[n].flags);
 		}
-		if (cmp < 0)
-			high = mid;
-		else
-			low = mid + 1;
+		pchputint(&w->body, m->ntoken);
+		for (n = 0; n < m->ntoken; ++n)
+			pchputtoken(w, &m->token[n]);
+	}
+}
+
+static void
+pchgettoken(struct pchreader *r, struct token *t)
+{
+	struct stringlit *data;
+	unsigned long long kind, flags;
+
+	kind = pchgetint(r);
+	/* T__ATTRIBUTE__ is the last token kind */
+	if (kind > T__ATTRIBUTE__)
+		pchcorrupt(r);
+	t->kind = kind;
+	flags = pchgetint(r);
+	t->space = flags & PCHSPACE;
+	t->hide = false;
+	if (flags & PCHFILE)
+		r->file = pchgetref(r);
+	t->loc.file = r->file;
+	t->loc.line = pchgetint(r);
+	t->loc.col = pchgetint(r);
+	if (t->kind == TEMBED) {
+		data = xmalloc(sizeof(*data));
+		data->size = pchgetcount(r);
+		data->data = xmalloc(data->size);
+		memcpy(data->data, r->pos, data->size);
+		r->pos += data->size;
+		t->lit = (char *)data;
+	} else {
+		t->lit = pchgetref(r);
+		if (!t->lit && !tokstr[t->kind])
+			pchcorrupt(r);
+	}
+}
+
+/* check that the files a precompiled header was built from have not changed */
+void
+ppreaddeps(struct pchreader *r)
+{
+	struct incfile *file;
+	struct fileinfo info;
+	unsigned long long sec, nsec, size;
+	char *path;
+	size_t n;
+
+	for (n = pchgetcount(r); n > 0; --n) {
+		path = pchgetstr(r);
+		if (!path)
+			pchcorrupt(r);
+		sec = pchgetint(r);
+		nsec = pchgetint(r);
+		size = pchgetint(r);
+		if (!pathinfo(path, &info) || info.mtime != sec || info.mtimensec != nsec || info.size != size)
+			fatal("%s: precompiled header is out of date; %s has changed", r->name, path);
+		file = incfile(&info, path);
+		file->once = pchgetint(r);
+		file->guard = pchgetstr(r);
+		if (file->guard)
+			file->guard = intern(file->guard, strlen(file->guard));
+	}
+}
+
+void
+ppreadmacros(struct pchreader *r)
+{
+	struct macro *m;
+	struct mapkey k;
+	size_t i, n;
+
+	for (n = pchgetcount(r); n > 0; --n) {
+		m = xmalloc(sizeof(*m));
+		m->name = pchgetref(r);
+		if (!m->name)
+			pchcorrupt(r);
+		m->hide = false;
+		m->kind = pchgetint(r);
+		m->nparam = pchgetcount(r);
+		m->param = xreallocarray(NULL, m->nparam, sizeof(m->param[0]));
+		for (i = 0; i < m->nparam; ++i) {
+			m->param[i].name = pchgetref(r);
+			m->param[i].flags = pchgetint(r);
+		}
+		m->ntoken = pchgetcount(r);
+		m->token = xreallocarray(NULL, m->ntoken, sizeof(m->token[0]));
+		m->paste = false;
+		m->subst = (struct array){0};
+		for (i = 0; i < m->ntoken; ++i) {
+			pchgettoken(r, &m->token[i]);
+			if (m->token[i].kind == THASHHASH)
+				m->paste = true;
+		}
+		atomkey(&k, m->name);
+		*mapput(&macros, &k) = m;
+	}
+}
+
+/* append a -D option to a buffer as a #define directive */
+static void
+defineopt(struct array *buf, const char *def)
+{
+	const char *eq;
+
+	arrayaddbuf(buf, "#define ", 8);
+	eq = strchr(def, '=');
+	if (eq) {
+		arrayaddbuf(buf, def, eq - def);
+		arrayaddbuf(buf, " ", 1);
+		arrayaddbuf(buf, eq + 1, strlen(eq + 1));
+	} else {
+		arrayaddbuf(buf, def, strlen(def));
+		arrayaddbuf(buf, " 1", 2);
+	}
+	arrayaddbuf(buf, "\n", 1);
+}
+
+void
+ppdefine(const char *def)
+{
+	defineopt(&cmdline, def);
+}
+
+void
+ppundef(const char *name)
+{
+	arrayaddbuf(&cmdline, "#undef ", 7);
+	arrayaddbuf(&cmdline, name, strlen(name));
+	arrayaddbuf(&cmdline, "\n", 1);
+}
+
+/* read the predefined macros and the -D and -U options before the input */
+static void
+predefine(void)
+{
+	struct array buf = {0};
+	const char *const *def;
+	size_t i;
+
+	for (i = 0; i < countof(predefined); ++i)
+		defineopt(&buf, predefined[i]);
+	for (def = targ->macros; *def; ++def)
+		defineopt(&buf, *def);
+	if (!targ->signedchar)
+		defineopt(&buf, "__CHAR_UNSIGNED__");
+	if (targ->typewchar->u.arith.issigned) {
+		defineopt(&buf, "__WCHAR_TYPE__=int");
+		defineopt(&buf, "__WCHAR_MAX__=0x7fffffff");
+		defineopt(&buf, "__WCHAR_MIN__=(-__WCHAR_MAX__-1)");
+	} else {
+		defineopt(&buf, "__WCHAR_TYPE__=unsigned int");
+		defineopt(&buf, "__WCHAR_MAX__=0xffffffffU");
+		defineopt(&buf, "__WCHAR_MIN__=0U");
+	}
+	arrayaddbuf(&buf, cmdline.val, cmdline.len);
+	arrayaddbuf(&buf, "", 1);
+	scantext("<built-in>", buf.val);
+	free(cmdline.val);
+}
+
+void
+ppinit(void)
+{
+	mapinit(&macros, 64);
+	mapinit(&incfiles, 64);
+	vaargs = intern("__VA_ARGS__", 11);
+	defined = intern("defined", 7);
+	hasinclude = intern("__has_include", 13);
+	filemacro = intern("__FILE__", 8);
+	linemacro = intern("__LINE__", 8);
+	datemacro = intern("__DATE__", 8);
+	timemacro = intern("__TIME__", 8);
+	keywordinit();
+	predefine();
+}
+
+static void
+keyword(struct token *tok)
+{
+	int kind;
+
+	kind = *atomdata(tok->lit);
+	if (kind) {
+		tok->kind = kind;
+		tok->lit = NULL;
 	}
 }
 
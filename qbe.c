@@ -1,7 +1,7 @@
 #include <assert.h>
 #include <ctype.h>
-#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -69,6 +69,18 @@ struct jump {
 	struct block *blk[2];
 };
 
+/* phi of a promoted local variable */
+struct phi {
+	int class;
+	struct value res;
+	size_t var;
+	/* incoming values, in the order of the block's predecessors */
+	struct value **val;
+	size_t nval;
+	bool live;
+	struct phi *next;
+};
+
 struct block {
 	struct value label;
 	struct array insts;
@@ -78,8 +90,23 @@ struct block {
 		struct value *val[2];
 		struct value res;
 	} phi;
+	struct phi *phis;
 	struct jump jump;
 
+	/* control flow and dominator tree, computed by promote() */
+	struct block **pred;
+	size_t npred;
+	struct block *idom, *child, *sibling;
+	unsigned po;
+	/* frontier of the dominator tree, and the last block added to it */
+	struct array df;
+	struct block *dflast;
+	/* last variable given a phi in this block, or queued with it */
+	size_t phivar, workvar;
+	/* incoming edges, and whether the block is kept, computed by simplify() */
+	size_t nin;
+	bool reach;
+
 	struct block *next;
 };
 
@@ -96,8 +123,15 @@ struct func {
 	struct block *start, *end;
 	struct map gotos;
 	unsigned lastid;
+	/* addresses of scalar locals that may be promoted to temporaries */
+	struct array locals;
 };
 
+enum optflags optflags;
+
+/* storage for the function being compiled, released by delfunc */
+static struct arena funcarena;
+
 static const int ptrclass = 'l';
 
 void
@@ -111,21 +145,108 @@ switchcase(struct switchcases *cases, unsigned long long i, struct block *b)
 	c->body = b;
 }
 
+/* output */
+
+/* buffer for the emitted IL, written to stdout in large chunks */
+static struct {
+	char buf[1<<16];
+	size_t len;
+	/* whether the IL is kept in captured instead, to be written to a precompiled header */
+	bool capture;
+	struct array captured;
+} out;
+
+static void
+outwrite(const char *s, size_t n)
+{
+	if (out.capture)
+		arrayaddbuf(&out.captured, s, n);
+	else
+		fwrite(s, 1, n, stdout);
+}
+
+void
+emitflush(void)
+{
+	outwrite(out.buf, out.len);
+	out.len = 0;
+}
+
+void
+emitcapture(void)
+{
+	out.capture = true;
+}
+
+static void
+outn(const char *s, size_t n)
+{
+	if (n > sizeof(out.buf) - out.len) {
+		emitflush();
+		if (n > sizeof(out.buf)) {
+			outwrite(s, n);
+			return;
+		}
+	}
+	memcpy(out.buf + out.len, s, n);
+	out.len += n;
+}
+
+static void
+outs(const char *s)
+{
+	outn(s, strlen(s));
+}
+
+static void
+outc(int c)
+{
+	if (out.len == sizeof(out.buf))
+		emitflush();
+	out.buf[out.len++] = c;
+}
+
+static void
+outu(unsigned long long n)
+{
+	char buf[20], *pos, *end;
+
+	pos = end = buf + sizeof(buf);
+	do *--pos = '0' + n % 10;
+	while (n /= 10);
+	outn(pos, end - pos);
+}
+
+static void
+outflt(int kind, double f)
+{
+	char buf[32];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%c_%.17g", kind, f);
+	assert(n > 0 && n < sizeof(buf));
+	outn(buf, n);
+}
+
 /* values */
 
+/* the last IDs given to blocks, globals without linkage, and types, which a precompiled header continues from */
+static unsigned blockid, globalid, typeid;
+
 struct block *
 mkblock(char *name)
 {
-	static unsigned id;
 	struct block *b;
 
-	b = xmalloc(sizeof(*b));
+	b = arenaalloc(&funcarena, sizeof(*b));
 	b->label.kind = VALUE_LABEL;
 	b->label.u.name = name;
-	b->label.id = ++id;
+	b->label.id = ++blockid;
 	b->insts = (struct array){0};
 	b->jump.kind = JUMP_NONE;
+	b->jump.arg = NULL;
 	b->phi.res.kind = VALUE_NONE;
+	b->phis = NULL;
 	b->next = NULL;
 
 	return b;
@@ -134,7 +255,6 @@ mkblock(char *name)
 struct value *
 mkglobal(struct decl *d)
 {
-	static unsigned id;
 	struct value *v;
 
 	v = xmalloc(sizeof(*v));
@@ -147,34 +267,53 @@ mkglobal(struct decl *d)
 		v->id = 0;
 	} else {
 		v->u.name = d->name;
-		v->id = d->linkage == LINKNONE ? ++id : 0;
+		v->id = d->linkage == LINKNONE ? ++globalid : 0;
 	}
 
 	return v;
 }
 
-struct value *
-mkintconst(unsigned long long n)
+/* constants are immutable, so each distinct one is allocated only once */
+static struct value *
+mkconst(int kind, unsigned long long i, double f)
 {
-	struct value *v;
-
-	v = xmalloc(sizeof(*v));
-	v->kind = VALUE_INTCONST;
-	v->u.i = n;
+	static struct map consts[3];
+	struct map *m;
+	struct mapkey k;
+	struct value c, *v;
+
+	m = &consts[kind - VALUE_INTCONST];
+	if (!m->cap)
+		mapinit(m, 256);
+	memset(&c.u, 0, sizeof(c.u));
+	if (kind == VALUE_INTCONST)
+		c.u.i = i;
+	else
+		c.u.f = f;
+	mapkey(&k, &c.u, sizeof(c.u));
+	v = mapget(m, &k);
+	if (!v) {
+		v = xmalloc(sizeof(*v));
+		v->kind = kind;
+		v->id = 0;
+		v->u = c.u;
+		k.str = &v->u;
+		*mapput(m, &k) = v;
+	}
 
 	return v;
 }
 
+struct value *
+mkintconst(unsigned long long n)
+{
+	return mkconst(VALUE_INTCONST, n, 0);
+}
+
 static struct value *
 mkfltconst(int kind, double n)
 {
-	struct value *v;
-
-	v = xmalloc(sizeof(*v));
-	v->kind = kind;
-	v->u.f = n;
-
-	return v;
+	return mkconst(kind, 0, n);
 }
 
 static struct qbetype
@@ -230,7 +369,7 @@ mkinst(struct func *f, int op, int class, struct value *arg0, struct value *arg1
 {
 	struct inst *inst;
 
-	inst = xmalloc(sizeof(*inst));
+	inst = arenaalloc(&funcarena, sizeof(*inst));
 	inst->kind = op;
 	inst->class = class;
 	inst->arg[0] = arg0;
@@ -404,6 +543,8 @@ funcalloc(struct func *f, struct decl *d)
 	case 16: op = IALLOC16; break;
 	}
 	v = funcinst(f, op, ptrclass, v, NULL);
+	if (d->type->prop & PROPSCALAR && d->type->size && !(d->qual & QUALVOLATILE) && align <= 16)
+		arrayaddptr(&f->locals, v);
 	if (align > 16) {
 		/* TODO: implement alloc32 in QBE and use that instead */
 		v = funcinst(f, IADD, ptrclass, v, mkintconst(align - 16));
@@ -413,9 +554,23 @@ funcalloc(struct func *f, struct decl *d)
 	f->end = end;
 }
 
+/* copies and zeroing that take more than this many stores call memcpy or memset instead */
+enum { MAXINLINESTORES = 16 };
+
+/* call memcpy or memset */
+static void
+funcmemcall(struct func *f, struct value *fn, struct value *dst, int class, struct value *arg, unsigned long long size)
+{
+	funcinst(f, ICALL, 0, fn, NULL);
+	funcinst(f, IARG, ptrclass, dst, NULL);
+	funcinst(f, IARG, class, arg, NULL);
+	funcinst(f, IARG, 'l', mkintconst(size), NULL);
+}
+
 static void
 funccopy(struct func *f, struct value *dst, struct value *src, unsigned long long size, int align)
 {
+	static struct value memcpyfn = {.kind = VALUE_GLOBAL, .u.name = "memcpy"};
 	enum instkind load, store;
 	int class;
 	struct value *tmp, *inc;
@@ -429,6 +584,10 @@ funccopy(struct func *f, struct value *dst, struct value *src, unsigned long lon
 	case 4: load = ILOADW, store = ISTOREW; break;
 	default: load = ILOADL, store = ISTOREL, align = 8, class = 'l'; break;
 	}
+	if (size > MAXINLINESTORES * align) {
+		funcmemcall(f, &memcpyfn, dst, ptrclass, src, size);
+		return;
+	}
 	inc = mkintconst(align);
 	off = 0;
 	for (;;) {
@@ -513,17 +672,18 @@ mkfunc(struct decl *decl, char *name, struct type *t, struct scope *s)
 	struct decl *d;
 	struct value *v;
 
-	f = xmalloc(sizeof(*f));
+	f = arenaalloc(&funcarena, sizeof(*f));
 	f->decl = decl;
 	f->name = name;
 	f->type = t;
 	f->start = f->end = mkblock("start");
 	f->lastid = 0;
+	f->locals = (struct array){0};
 	mapinit(&f->gotos, 8);
 	emittype(t->base);
 
 	/* allocate space for parameters */
-	f->paramtemps = xreallocarray(NULL, t->u.func.nparam, sizeof *f->paramtemps);
+	f->paramtemps = arenaalloc(&funcarena, t->u.func.nparam * sizeof *f->paramtemps);
 	for (d = t->u.func.params, v = f->paramtemps; d; d = d->next, ++v) {
 		emittype(d->type);
 		functemp(f, v);
@@ -538,7 +698,7 @@ mkfunc(struct decl *decl, char *name, struct type *t, struct scope *s)
 	}
 
 	t = mkarraytype(&typechar, QUALCONST, strlen(name) + 1);
-	d = mkdecl("__func__", DECLOBJECT, t, QUALNONE, LINKNONE);
+	d = mkdecl(intern("__func__", 8), DECLOBJECT, t, QUALNONE, LINKNONE);
 	d->u.obj.storage = SDSTATIC;
 	d->value = mkglobal(d);
 	scopeputdecl(s, d);
@@ -553,17 +713,12 @@ void
 delfunc(struct func *f)
 {
 	struct block *b;
-	struct inst **inst;
 
-	while (b = f->start) {
-		f->start = b->next;
-		arrayforeach (&b->insts, inst)
-			free(*inst);
+	for (b = f->start; b; b = b->next)
 		free(b->insts.val);
-		free(b);
-	}
-	mapfree(&f->gotos, free);
-	free(f);
+	free(f->locals.val);
+	mapfree(&f->gotos, NULL);
+	arenareset(&funcarena);
 }
 
 struct type *
@@ -642,11 +797,11 @@ funcgoto(struct func *f, char *name)
 	struct gotolabel *g;
 	struct mapkey key;
 
-	mapkey(&key, name, strlen(name));
+	atomkey(&key, name);
 	entry = mapput(&f->gotos, &key);
 	g = *entry;
 	if (!g) {
-		g = xmalloc(sizeof(*g));
+		g = arenaalloc(&funcarena, sizeof(*g));
 		g->label = mkblock(name);
 		*entry = g;
 	}
@@ -670,9 +825,11 @@ funclval(struct func *f, struct expr *e)
 		if (d->kind != DECLOBJECT && d->kind != DECLFUNC)
 			error(&tok.loc, "identifier '%s' is not an object or function", d->name);
 		if (d == f->namedecl) {
-			fputs("data ", stdout);
+			outs("data ");
 			emitname(d->value);
-			printf(" = { b \"%s\", b 0 }\n", f->name);
+			outs(" = { b \"");
+			outs(f->name);
+			outs("\", b 0 }\n");
 			f->namedecl = NULL;
 		}
 		lval.addr = d->value;
@@ -804,7 +961,7 @@ funcexpr(struct func *f, struct expr *e)
 		v = funcstore(f, e->type, e->qual, lval, v);
 		return e->u.incdec.post ? l : v;
 	case EXPRCALL:
-		argvals = xreallocarray(NULL, e->u.call.nargs, sizeof(argvals[0]));
+		argvals = arenaalloc(&funcarena, e->u.call.nargs * sizeof(argvals[0]));
 		for (arg = e->u.call.args, i = 0; arg; arg = arg->next, ++i) {
 			emittype(arg->type);
 			argvals[i] = funcexpr(f, arg);
@@ -1033,9 +1190,15 @@ zero(struct func *func, struct value *addr, int align, unsigned long long offset
 		[8] = ISTOREL,
 	};
 	static struct value z = {.kind = VALUE_INTCONST};
+	static struct value memsetfn = {.kind = VALUE_GLOBAL, .u.name = "memset"};
 	struct value *tmp;
 	int a = 1;
 
+	if (offset < end && end - offset > MAXINLINESTORES * align) {
+		tmp = offset ? funcinst(func, IADD, ptrclass, addr, mkintconst(offset)) : addr;
+		funcmemcall(func, &memsetfn, tmp, 'w', &z, end - offset);
+		return;
+	}
 	while (offset < end) {
 		if ((align - (offset & align - 1)) & a) {
 			tmp = offset ? funcinst(func, IADD, ptrclass, addr, mkintconst(offset)) : addr;
@@ -1094,40 +1257,842 @@ funcinit(struct func *func, struct decl *d, struct init *init, bool hasinit)
 	zero(func, d->value, d->type->align, max, d->type->size);
 }
 
+/* a run of consecutive values in a dense case cluster with the same destination */
+struct caserun {
+	unsigned long long start;
+	struct block *body;
+};
+
+/* one case, or a dense range of cases dispatched together */
+struct casecluster {
+	unsigned long long lo, hi;
+	struct switchcase **cases;
+	size_t ncases;
+};
+
 static void
-casesearch(struct func *f, int class, struct value *v, struct switchcase *c, struct block *defaultlabel, unsigned long long min, unsigned long long max)
+caselist(struct array *cases, struct switchcase *c)
 {
-	struct value *res, *key;
+	if (!c)
+		return;
+	caselist(cases, c->node.child[0]);
+	arrayaddptr(cases, c);
+	caselist(cases, c->node.child[1]);
+}
+
+/* bisect on the index into a case cluster, using one comparison per level */
+static void
+casebisect(struct func *f, int class, struct value *idx, struct caserun *r, size_t n)
+{
+	struct value *res;
+	struct block *label[2];
+
+	if (n == 1) {
+		funcjmp(f, r->body);
+		return;
+	}
+	label[0] = mkblock("switch_lt");
+	label[1] = mkblock("switch_ge");
+	res = funcinst(f, class == 'w' ? ICULTW : ICULTL, 'w', idx, mkintconst(r[n / 2].start));
+	funcjnz(f, res, NULL, label[0], label[1]);
+	funclabel(f, label[0]);
+	casebisect(f, class, idx, r, n / 2);
+	funclabel(f, label[1]);
+	casebisect(f, class, idx, r + n / 2, n - n / 2);
+}
+
+static void
+casetable(struct func *f, int class, struct value *idx, struct casecluster *c, struct block *defaultlabel)
+{
+	struct array runs = {0};
+	struct caserun *r;
+	unsigned long long i, next;
+	size_t n;
+
+	next = 0;
+	for (n = 0; n < c->ncases; ++n) {
+		i = c->cases[n]->node.key - c->lo;
+		if (i > next) {
+			r = arrayadd(&runs, sizeof(*r));
+			r->start = next;
+			r->body = defaultlabel;
+		}
+		r = arraylast(&runs, sizeof(*r));
+		if (!r || r->body != c->cases[n]->body) {
+			r = arrayadd(&runs, sizeof(*r));
+			r->start = i;
+			r->body = c->cases[n]->body;
+		}
+		next = i + 1;
+	}
+	casebisect(f, class, idx, runs.val, runs.len / sizeof(*r));
+	free(runs.val);
+}
+
+static void
+casesearch(struct func *f, int class, struct value *v, struct casecluster *c, size_t n, struct block *defaultlabel, unsigned long long min, unsigned long long max)
+{
+	struct value *res, *key, *idx;
 	struct block *label[3];
+	struct casecluster *mid;
 
-	if (!c) {
+	if (n == 0) {
 		funcjmp(f, defaultlabel);
 		return;
 	}
+	mid = &c[n / 2];
 	if (min == max) {
-		funcjmp(f, c->body);
+		funcjmp(f, mid->cases[0]->body);
+		return;
+	}
+	key = mkintconst(mid->lo);
+	if (mid->ncases == 1) {
+		label[0] = mkblock("switch_ne");
+		res = funcinst(f, class == 'w' ? ICEQW : ICEQL, 'w', v, key);
+		funcjnz(f, res, NULL, mid->cases[0]->body, label[0]);
+	} else {
+		/* bounds check, then dispatch within the cluster */
+		label[0] = mkblock("switch_out");
+		idx = funcinst(f, ISUB, class, v, key);
+		res = funcinst(f, class == 'w' ? ICULTW : ICULTL, 'w', idx, mkintconst(mid->hi - mid->lo + 1));
+		label[1] = mkblock("switch_table");
+		funcjnz(f, res, NULL, label[1], label[0]);
+		funclabel(f, label[1]);
+		casetable(f, class, idx, mid, defaultlabel);
+	}
+	funclabel(f, label[0]);
+	if (n == 1) {
+		funcjmp(f, defaultlabel);
 		return;
 	}
-	label[0] = mkblock("switch_ne");
 	label[1] = mkblock("switch_lt");
 	label[2] = mkblock("switch_gt");
-
-	key = mkintconst(c->node.key);
-	res = funcinst(f, class == 'w' ? ICEQW : ICEQL, 'w', v, key);
-	funcjnz(f, res, NULL, c->body, label[0]);
-	funclabel(f, label[0]);
 	res = funcinst(f, class == 'w' ? ICULTW : ICULTL, 'w', v, key);
 	funcjnz(f, res, NULL, label[1], label[2]);
 	funclabel(f, label[1]);
-	casesearch(f, class, v, c->node.child[0], defaultlabel, min, c->node.key - 1);
+	casesearch(f, class, v, c, n / 2, defaultlabel, min, mid->lo - 1);
 	funclabel(f, label[2]);
-	casesearch(f, class, v, c->node.child[1], defaultlabel, c->node.key + 1, max);
+	casesearch(f, class, v, mid + 1, n - n / 2 - 1, defaultlabel, mid->hi + 1, max);
 }
 
 void
 funcswitch(struct func *f, struct value *v, struct switchcases *c, struct block *defaultlabel)
 {
-	casesearch(f, qbetype(c->type).base, v, c->root, defaultlabel, 0, -1);
+	struct array cases = {0}, clusters = {0};
+	struct switchcase **sc;
+	struct casecluster *cl;
+	size_t i, j, n;
+
+	caselist(&cases, c->root);
+	sc = cases.val;
+	n = cases.len / sizeof(*sc);
+	/*
+	Group runs of at least 4 cases that cover at least half of
+	their range into clusters. These are dispatched with a bounds
+	check followed by a bisection on the offset into the range,
+	and the remaining cases with a binary search on their value.
+	*/
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && sc[j]->node.key - sc[i]->node.key < 2 * (j - i + 1); ++j)
+			;
+		if (j - i < 4)
+			j = i + 1;
+		cl = arrayadd(&clusters, sizeof(*cl));
+		cl->lo = sc[i]->node.key;
+		cl->hi = sc[j - 1]->node.key;
+		cl->cases = &sc[i];
+		cl->ncases = j - i;
+	}
+	casesearch(f, qbetype(c->type).base, v, clusters.val, clusters.len / sizeof(*cl), defaultlabel, 0, -1);
+	free(clusters.val);
+	free(cases.val);
+}
+
+/* promotion of local variables to temporaries */
+
+struct localvar {
+	enum instkind load, store;
+	int class;
+	/* whether the address is only used to load and store values of the same type */
+	bool promote;
+	/* whether the variable may be loaded in a block before it is stored */
+	bool global;
+	/* blocks that store to the variable, and the last one found */
+	struct array defs;
+	struct block *lastdef;
+	/* value of the variable before it is first stored */
+	struct value *undef;
+};
+
+struct promoter {
+	struct localvar *var;
+	/* one more than the index of the variable at each temporary */
+	size_t *varof;
+	/* the value that replaces each removed load */
+	struct value **repl;
+	unsigned ntemp;
+};
+
+/* the store instruction matching a load, or INONE if it is not a load */
+static enum instkind
+loadstore(enum instkind op)
+{
+	switch (op) {
+	case ILOADD:  return ISTORED;
+	case ILOADS:  return ISTORES;
+	case ILOADL:  return ISTOREL;
+	case ILOADW:  return ISTOREW;
+	case ILOADSH:
+	case ILOADUH: return ISTOREH;
+	case ILOADSB:
+	case ILOADUB: return ISTOREB;
+	}
+	return INONE;
+}
+
+static bool
+isstore(enum instkind op)
+{
+	return ISTORED <= op && op <= ISTOREB;
+}
+
+/* the successors of a block, counting both targets of a jnz only if they differ */
+static size_t
+blocksucc(struct block *b, struct block *s[2])
+{
+	switch (b->jump.kind) {
+	case JUMP_NONE:
+		s[0] = b->next;
+		return b->next != NULL;
+	case JUMP_JMP:
+		s[0] = b->jump.blk[0];
+		return 1;
+	case JUMP_JNZ:
+		s[0] = b->jump.blk[0];
+		s[1] = b->jump.blk[1];
+		return s[0] == s[1] ? 1 : 2;
+	}
+	return 0;
+}
+
+static struct localvar *
+localvar(struct promoter *p, struct value *v)
+{
+	if (!v || v->kind != VALUE_TEMP || v->id >= p->ntemp || !p->varof[v->id])
+		return NULL;
+	return &p->var[p->varof[v->id] - 1];
+}
+
+static struct value *
+promoted(struct promoter *p, struct value *v)
+{
+	while (v && v->kind == VALUE_TEMP && v->id < p->ntemp && p->repl[v->id])
+		v = p->repl[v->id];
+	return v;
+}
+
+static struct block *
+domintersect(struct block *b1, struct block *b2)
+{
+	while (b1 != b2) {
+		while (b1->po < b2->po)
+			b1 = b1->idom;
+		while (b2->po < b1->po)
+			b2 = b2->idom;
+	}
+	return b1;
+}
+
+/* check which locals can be promoted, and find the blocks that store to them */
+static bool
+promotecheck(struct func *f, struct promoter *p, size_t nvar)
+{
+	struct block *b;
+	struct inst **inst, **instend;
+	struct localvar *var;
+	size_t i, j;
+	bool any;
+
+	for (b = f->start; b; b = b->next) {
+		instend = (struct inst **)((char *)b->insts.val + b->insts.len);
+		for (inst = b->insts.val; inst != instend; ++inst) {
+			for (j = 0; j < 2; ++j) {
+				var = localvar(p, (*inst)->arg[j]);
+				if (!var)
+					continue;
+				if (j == 0 && loadstore((*inst)->kind)) {
+					if (var->load && var->load != (*inst)->kind)
+						var->promote = false;
+					var->load = (*inst)->kind;
+					if (var->lastdef != b)
+						var->global = true;
+				} else if (j == 1 && isstore((*inst)->kind)) {
+					if (var->store && var->store != (*inst)->kind)
+						var->promote = false;
+					var->store = (*inst)->kind;
+					if (var->lastdef != b) {
+						arrayaddptr(&var->defs, b);
+						var->lastdef = b;
+					}
+				} else {
+					var->promote = false;
+				}
+			}
+		}
+		if ((var = localvar(p, b->jump.arg)))
+			var->promote = false;
+		if (b->phi.res.kind) {
+			for (j = 0; j < 2; ++j) {
+				if ((var = localvar(p, b->phi.val[j])))
+					var->promote = false;
+			}
+		}
+	}
+	any = false;
+	for (i = 0; i < nvar; ++i) {
+		var = &p->var[i];
+		if (var->load && var->store && loadstore(var->load) != var->store)
+			var->promote = false;
+		if (!var->promote)
+			continue;
+		any = true;
+		switch (var->store ? var->store : loadstore(var->load)) {
+		case ISTORED: var->class = 'd', var->undef = mkfltconst(VALUE_DBLCONST, 0); break;
+		case ISTORES: var->class = 's', var->undef = mkfltconst(VALUE_FLTCONST, 0); break;
+		case ISTOREL: var->class = 'l', var->undef = mkintconst(0); break;
+		default:      var->class = 'w', var->undef = mkintconst(0); break;
+		}
+	}
+	return any;
+}
+
+/* compute predecessors and the dominator tree and its frontiers */
+static void
+promotecfg(struct func *f, struct block *root)
+{
+	struct {
+		struct block *b;
+		size_t i;
+	} *stack;
+	struct block *b, *s[2], **order, *idom;
+	size_t nblock, npo, n, i, j;
+	bool changed;
+
+	nblock = 0;
+	for (b = f->start; b; b = b->next) {
+		b->npred = 0;
+		b->po = 0;
+		b->idom = b->child = NULL;
+		b->df = (struct array){0};
+		b->dflast = NULL;
+		b->phivar = b->workvar = 0;
+		++nblock;
+	}
+	for (b = f->start; b; b = b->next) {
+		for (i = blocksucc(b, s); i > 0; --i)
+			++s[i - 1]->npred;
+	}
+	for (b = f->start; b; b = b->next) {
+		b->pred = arenaalloc(&funcarena, b->npred * sizeof(b->pred[0]));
+		b->npred = 0;
+	}
+	for (b = f->start; b; b = b->next) {
+		for (i = 0, n = blocksucc(b, s); i < n; ++i)
+			s[i]->pred[s[i]->npred++] = b;
+	}
+
+	/*
+	Number the blocks in postorder. Blocks that are unreachable from
+	the start are visited afterwards, as if they were reachable from
+	a root that dominates every block.
+	*/
+	order = arenaalloc(&funcarena, nblock * sizeof(order[0]));
+	stack = arenaalloc(&funcarena, nblock * sizeof(stack[0]));
+	npo = 0;
+	root->child = NULL;
+	for (b = f->start; b; b = b->next) {
+		if (b->po)
+			continue;
+		b->po = -1;
+		b->idom = root;
+		stack[0].b = b;
+		stack[0].i = 0;
+		for (n = 1; n > 0;) {
+			if (stack[n - 1].i < blocksucc(stack[n - 1].b, s)) {
+				b = s[stack[n - 1].i++];
+				if (!b->po) {
+					b->po = -1;
+					stack[n].b = b;
+					stack[n].i = 0;
+					++n;
+				}
+			} else {
+				b = stack[--n].b;
+				b->po = ++npo;
+				order[npo - 1] = b;
+			}
+		}
+	}
+	root->po = npo + 1;
+	root->idom = root;
+
+	/* Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm" */
+	do {
+		changed = false;
+		for (i = npo; i-- > 0;) {
+			b = order[i];
+			if (b->idom == root)
+				continue;
+			idom = NULL;
+			for (j = 0; j < b->npred; ++j) {
+				if (b->pred[j]->idom)
+					idom = idom ? domintersect(b->pred[j], idom) : b->pred[j];
+			}
+			if (b->idom != idom) {
+				b->idom = idom;
+				changed = true;
+			}
+		}
+	} while (changed);
+
+	for (i = 0; i < npo; ++i) {
+		b = order[i];
+		b->sibling = b->idom->child;
+		b->idom->child = b;
+		for (j = 0; j < b->npred; ++j) {
+			for (idom = b->pred[j]; idom != b->idom; idom = idom->idom) {
+				if (idom->dflast != b) {
+					arrayaddptr(&idom->df, b);
+					idom->dflast = b;
+				}
+			}
+		}
+	}
+}
+
+/* insert phis at the iterated dominance frontier of the stores to each variable */
+static void
+promotephis(struct func *f, struct promoter *p, size_t nvar)
+{
+	struct array work = {0};
+	struct localvar *var;
+	struct block **b, **df, **dfend;
+	struct phi *phi;
+	size_t i;
+
+	for (i = 0; i < nvar; ++i) {
+		var = &p->var[i];
+		if (!var->promote || !var->global)
+			continue;
+		arrayforeach (&var->defs, b) {
+			(*b)->workvar = i + 1;
+			arrayaddptr(&work, *b);
+		}
+		while (work.len) {
+			work.len -= sizeof(*b);
+			b = (struct block **)((char *)work.val + work.len);
+			df = (*b)->df.val;
+			dfend = (struct block **)((char *)df + (*b)->df.len);
+			for (; df != dfend; ++df) {
+				if ((*df)->phivar == i + 1)
+					continue;
+				(*df)->phivar = i + 1;
+				phi = arenaalloc(&funcarena, sizeof(*phi));
+				phi->class = var->class;
+				functemp(f, &phi->res);
+				phi->var = i;
+				phi->nval = (*df)->npred;
+				phi->val = arenaalloc(&funcarena, phi->nval * sizeof(phi->val[0]));
+				phi->live = false;
+				phi->next = (*df)->phis;
+				(*df)->phis = phi;
+				if ((*df)->workvar != i + 1) {
+					(*df)->workvar = i + 1;
+					arrayaddptr(&work, *df);
+				}
+			}
+		}
+	}
+	free(work.val);
+}
+
+/* replace loads and stores of promoted variables, walking the dominator tree */
+static void
+promoterename(struct func *f, struct promoter *p, size_t nvar, struct block *root)
+{
+	struct undo {
+		size_t var;
+		struct value *val;
+	} *u;
+	struct {
+		struct block *b;
+		size_t undo;
+		bool done;
+	} *stack;
+	struct array undo = {0};
+	struct value **cur;
+	struct localvar *var;
+	struct block *b, *s[2];
+	struct inst **inst, **instend;
+	struct phi *phi;
+	size_t i, j, n, nsucc, nblock;
+	enum instkind op;
+
+	cur = arenaalloc(&funcarena, nvar * sizeof(cur[0]));
+	for (i = 0; i < nvar; ++i)
+		cur[i] = p->var[i].undef;
+	nblock = 0;
+	for (b = f->start; b; b = b->next)
+		++nblock;
+	stack = arenaalloc(&funcarena, 2 * nblock * sizeof(stack[0]));
+	n = 0;
+	for (b = root->child; b; b = b->sibling) {
+		stack[n].b = b;
+		stack[n].done = false;
+		++n;
+	}
+	while (n > 0) {
+		--n;
+		if (stack[n].done) {
+			/* restore the values from before the block */
+			while (undo.len > stack[n].undo) {
+				undo.len -= sizeof(*u);
+				u = (struct undo *)((char *)undo.val + undo.len);
+				cur[u->var] = u->val;
+			}
+			continue;
+		}
+		b = stack[n].b;
+		stack[n].undo = undo.len;
+		stack[n].done = true;
+		++n;
+		for (phi = b->phis; phi; phi = phi->next) {
+			u = arrayadd(&undo, sizeof(*u));
+			u->var = phi->var;
+			u->val = cur[phi->var];
+			cur[phi->var] = &phi->res;
+		}
+		instend = (struct inst **)((char *)b->insts.val + b->insts.len);
+		for (inst = b->insts.val; inst != instend; ++inst) {
+			if (loadstore((*inst)->kind) && (var = localvar(p, (*inst)->arg[0]))) {
+				i = var - p->var;
+				switch ((*inst)->kind) {
+				case ILOADSB: op = IEXTSB; break;
+				case ILOADUB: op = IEXTUB; break;
+				case ILOADSH: op = IEXTSH; break;
+				case ILOADUH: op = IEXTUH; break;
+				default:      op = INONE;  break;
+				}
+				/* narrow values still need to be truncated and extended */
+				if (op == INONE)
+					p->repl[(*inst)->res.id] = cur[i];
+				(*inst)->kind = op;
+				(*inst)->arg[0] = cur[i];
+			} else if (isstore((*inst)->kind) && (var = localvar(p, (*inst)->arg[1]))) {
+				i = var - p->var;
+				u = arrayadd(&undo, sizeof(*u));
+				u->var = i;
+				u->val = cur[i];
+				cur[i] = (*inst)->arg[0];
+				(*inst)->kind = INONE;
+			} else if (localvar(p, &(*inst)->res)) {
+				/* the alloc */
+				(*inst)->kind = INONE;
+			}
+		}
+		nsucc = blocksucc(b, s);
+		for (i = 0; i < nsucc; ++i) {
+			for (j = 0; s[i]->pred[j] != b; ++j)
+				;
+			for (phi = s[i]->phis; phi; phi = phi->next)
+				phi->val[j] = cur[phi->var];
+		}
+		for (b = b->child; b; b = b->sibling) {
+			stack[n].b = b;
+			stack[n].done = false;
+			++n;
+		}
+	}
+	free(undo.val);
+}
+
+static void
+phimark(struct array *work, struct phi **phiof, unsigned ntemp, struct value *v)
+{
+	struct phi *phi;
+
+	if (!v || v->kind != VALUE_TEMP || v->id >= ntemp || !(phi = phiof[v->id]) || phi->live)
+		return;
+	phi->live = true;
+	arrayaddptr(work, phi);
+}
+
+/* apply the replacements, remove unused phis and deleted instructions */
+static void
+promotefinish(struct func *f, struct promoter *p)
+{
+	struct array work = {0};
+	struct block *b;
+	struct inst **inst, **instend, **out;
+	struct phi *phi, **phiof, **link;
+	size_t j;
+
+	phiof = arenaalloc(&funcarena, (f->lastid + 1) * sizeof(phiof[0]));
+	memset(phiof, 0, (f->lastid + 1) * sizeof(phiof[0]));
+	for (b = f->start; b; b = b->next) {
+		for (phi = b->phis; phi; phi = phi->next) {
+			for (j = 0; j < phi->nval; ++j)
+				phi->val[j] = promoted(p, phi->val[j]);
+			phiof[phi->res.id] = phi;
+		}
+	}
+	for (b = f->start; b; b = b->next) {
+		instend = (struct inst **)((char *)b->insts.val + b->insts.len);
+		for (inst = out = b->insts.val; inst != instend; ++inst) {
+			if ((*inst)->kind == INONE)
+				continue;
+			for (j = 0; j < 2; ++j) {
+				(*inst)->arg[j] = promoted(p, (*inst)->arg[j]);
+				phimark(&work, phiof, f->lastid + 1, (*inst)->arg[j]);
+			}
+			*out++ = *inst;
+		}
+		b->insts.len = (char *)out - (char *)b->insts.val;
+		b->jump.arg = promoted(p, b->jump.arg);
+		phimark(&work, phiof, f->lastid + 1, b->jump.arg);
+		if (b->phi.res.kind) {
+			for (j = 0; j < 2; ++j) {
+				b->phi.val[j] = promoted(p, b->phi.val[j]);
+				phimark(&work, phiof, f->lastid + 1, b->phi.val[j]);
+			}
+		}
+	}
+	/* phis that are only used by other unused phis are removed */
+	while (work.len) {
+		work.len -= sizeof(phi);
+		phi = *(struct phi **)((char *)work.val + work.len);
+		for (j = 0; j < phi->nval; ++j)
+			phimark(&work, phiof, f->lastid + 1, phi->val[j]);
+	}
+	free(work.val);
+	for (b = f->start; b; b = b->next) {
+		for (link = &b->phis; *link;) {
+			if ((*link)->live)
+				link = &(*link)->next;
+			else
+				*link = (*link)->next;
+		}
+	}
+}
+
+static void
+promote(struct func *f)
+{
+	struct promoter p;
+	struct block root, *b;
+	struct value **local;
+	size_t i, nvar;
+
+	nvar = f->locals.len / sizeof(*local);
+	if (nvar == 0)
+		return;
+	p.ntemp = f->lastid + 1;
+	p.varof = arenaalloc(&funcarena, p.ntemp * sizeof(p.varof[0]));
+	memset(p.varof, 0, p.ntemp * sizeof(p.varof[0]));
+	p.var = arenaalloc(&funcarena, nvar * sizeof(p.var[0]));
+	for (i = 0, local = f->locals.val; i < nvar; ++i) {
+		p.varof[local[i]->id] = i + 1;
+		p.var[i] = (struct localvar){.promote = true};
+	}
+	if (promotecheck(f, &p, nvar)) {
+		for (i = 0; i < nvar; ++i) {
+			if (!p.var[i].promote)
+				p.varof[local[i]->id] = 0;
+		}
+		p.repl = arenaalloc(&funcarena, p.ntemp * sizeof(p.repl[0]));
+		memset(p.repl, 0, p.ntemp * sizeof(p.repl[0]));
+		promotecfg(f, &root);
+		promotephis(f, &p, nvar);
+		promoterename(f, &p, nvar, &root);
+		promotefinish(f, &p);
+		for (b = f->start; b; b = b->next)
+			free(b->df.val);
+	}
+	for (i = 0; i < nvar; ++i)
+		free(p.var[i].defs.val);
+}
+
+/* simplification of the control flow graph */
+
+/* the block that an empty block continues to, or NULL */
+static struct block *
+emptysucc(struct block *b)
+{
+	if (b->insts.len > 0 || b->phis || b->phi.res.kind || b->jump.kind != JUMP_JMP)
+		return NULL;
+	return b->jump.blk[0];
+}
+
+/* replace the predecessor old of b with new in its phis */
+static void
+phirename(struct block *b, struct block *old, struct block *new)
+{
+	size_t i;
+
+	if (b->phi.res.kind) {
+		for (i = 0; i < 2; ++i) {
+			if (b->phi.blk[i] == old)
+				b->phi.blk[i] = new;
+		}
+	}
+	if (b->phis) {
+		for (i = 0; i < b->npred; ++i) {
+			if (b->pred[i] == old)
+				b->pred[i] = new;
+		}
+	}
+}
+
+/* redirect an edge out of b past empty blocks, other being the other target of a jnz */
+static void
+thread(struct block *b, struct block **edge, struct block *other, size_t nblock)
+{
+	struct block *t, *s;
+
+	for (t = *edge; nblock > 0 && (s = emptysucc(t)) && s != t; --nblock) {
+		if (s->phis || s->phi.res.kind) {
+			/* phis can only be moved to b if it was the only way into t */
+			if (t->nin != 1 || s == other)
+				break;
+			phirename(s, t, b);
+		}
+		--t->nin;
+		++s->nin;
+		t = s;
+	}
+	*edge = t;
+}
+
+/* remove unreachable blocks, thread jumps through empty blocks, and merge straight-line blocks */
+static void
+simplify(struct func *f)
+{
+	struct block *b, *s, *succ[2], **stack, **link;
+	struct phi *phi;
+	size_t nblock, n, i, j;
+	bool prune;
+
+	nblock = 0;
+	for (b = f->start; b; b = b->next) {
+		/* make fall through explicit while blocks are removed */
+		if (b->jump.kind == JUMP_NONE && b->next) {
+			b->jump.kind = JUMP_JMP;
+			b->jump.blk[0] = b->next;
+		} else if (b->jump.kind == JUMP_JNZ && b->jump.blk[0] == b->jump.blk[1]) {
+			b->jump.kind = JUMP_JMP;
+		}
+		b->nin = 0;
+		b->reach = false;
+		++nblock;
+	}
+	for (b = f->start; b; b = b->next) {
+		for (i = blocksucc(b, succ); i > 0; --i)
+			++succ[i - 1]->nin;
+	}
+	for (b = f->start; b; b = b->next) {
+		switch (b->jump.kind) {
+		case JUMP_JMP:
+			thread(b, &b->jump.blk[0], NULL, nblock);
+			break;
+		case JUMP_JNZ:
+			thread(b, &b->jump.blk[0], b->jump.blk[1], nblock);
+			thread(b, &b->jump.blk[1], b->jump.blk[0], nblock);
+			if (b->jump.blk[0] == b->jump.blk[1]) {
+				b->jump.kind = JUMP_JMP;
+				--b->jump.blk[0]->nin;
+			}
+			break;
+		}
+	}
+
+	stack = arenaalloc(&funcarena, nblock * sizeof(stack[0]));
+	stack[0] = f->start;
+	f->start->reach = true;
+	for (n = 1; n > 0;) {
+		b = stack[--n];
+		for (i = blocksucc(b, succ); i > 0; --i) {
+			s = succ[i - 1];
+			if (!s->reach) {
+				s->reach = true;
+				stack[n++] = s;
+			}
+		}
+	}
+	/*
+	The phi of a conditional expression always has two operands, so
+	if one of them comes from unreachable code, keep every block.
+	*/
+	prune = true;
+	for (b = f->start; b; b = b->next) {
+		if (b->reach && b->phi.res.kind && (!b->phi.blk[0]->reach || !b->phi.blk[1]->reach))
+			prune = false;
+	}
+	for (b = f->start; b; b = b->next) {
+		if (!prune)
+			b->reach = true;
+		b->nin = 0;
+	}
+	for (b = f->start; b; b = b->next) {
+		if (!b->reach)
+			continue;
+		for (i = blocksucc(b, succ); i > 0; --i)
+			++succ[i - 1]->nin;
+		if (!b->phis)
+			continue;
+		for (i = j = 0; i < b->npred; ++i) {
+			if (!b->pred[i]->reach)
+				continue;
+			b->pred[j] = b->pred[i];
+			for (phi = b->phis; phi; phi = phi->next)
+				phi->val[j] = phi->val[i];
+			++j;
+		}
+		b->npred = j;
+		for (phi = b->phis; phi; phi = phi->next)
+			phi->nval = j;
+	}
+
+	for (b = f->start; b; b = b->next) {
+		if (!b->reach)
+			continue;
+		while (b->jump.kind == JUMP_JMP) {
+			s = b->jump.blk[0];
+			if (s == b || s->nin != 1 || s->phis || s->phi.res.kind)
+				break;
+			arrayaddbuf(&b->insts, s->insts.val, s->insts.len);
+			b->jump = s->jump;
+			s->reach = false;
+			for (i = blocksucc(b, succ); i > 0; --i)
+				phirename(succ[i - 1], s, b);
+		}
+	}
+
+	link = &f->start;
+	for (b = f->start; b; b = s) {
+		s = b->next;
+		if (!b->reach) {
+			free(b->insts.val);
+			continue;
+		}
+		*link = b;
+		link = &b->next;
+		f->end = b;
+	}
+	*link = NULL;
+	for (b = f->start; b; b = b->next) {
+		if (b->jump.kind == JUMP_JMP && b->jump.blk[0] == b->next)
+			b->jump.kind = JUMP_NONE;
+	}
 }
 
 /* emit */
@@ -1146,17 +2111,19 @@ emitname(struct value *v)
 	kind = v->kind & 0xf;
 	if (kind >= countof(sigil) || !sigil[kind])
 		fatal("invalid value");
-	putchar(sigil[kind]);
+	outc(sigil[kind]);
 	if (kind == VALUE_GLOBAL && v->id)
-		fputs(".L", stdout);
+		outs(".L");
 	if (v->kind & VALUE_QUOTE)
-		putchar('"');
+		outc('"');
 	if (v->u.name)
-		fputs(v->u.name, stdout);
+		outs(v->u.name);
 	if (v->kind & VALUE_QUOTE)
-		putchar('"');
-	if (v->id)
-		printf(".%u", v->id);
+		outc('"');
+	if (v->id) {
+		outc('.');
+		outu(v->id);
+	}
 }
 
 static void
@@ -1164,17 +2131,17 @@ emitvalue(struct value *v)
 {
 	switch (v->kind & 0xf) {
 	case VALUE_INTCONST:
-		printf("%llu", v->u.i);
+		outu(v->u.i);
 		break;
 	case VALUE_FLTCONST:
-		printf("s_%.17g", v->u.f);
+		outflt('s', v->u.f);
 		break;
 	case VALUE_DBLCONST:
-		printf("d_%.17g", v->u.f);
+		outflt('d', v->u.f);
 		break;
 	case VALUE_GLOBAL:
 		if (v->kind & VALUE_THREAD)
-			fputs("thread ", stdout);
+			outs("thread ");
 		/* fallthrough */
 	default:
 		emitname(v);
@@ -1188,7 +2155,7 @@ emitclass(int class, struct value *v)
 	if (v && v->kind == VALUE_TYPE)
 		emitname(v);
 	else if (class)
-		putchar(class);
+		outc(class);
 	else
 		fatal("type has no QBE representation");
 }
@@ -1197,7 +2164,6 @@ emitclass(int class, struct value *v)
 static void
 emittype(struct type *t)
 {
-	static unsigned id;
 	struct member *m, *other;
 	struct type *sub;
 	unsigned long long off;
@@ -1207,19 +2173,23 @@ emittype(struct type *t)
 	t->value = xmalloc(sizeof(*t->value));
 	t->value->kind = VALUE_TYPE;
 	t->value->u.name = t->u.structunion.tag;
-	t->value->id = ++id;
+	t->value->id = ++typeid;
 	for (m = t->u.structunion.members; m; m = m->next) {
 		for (sub = m->type; sub->kind == TYPEARRAY; sub = sub->base)
 			;
 		emittype(sub);
 	}
-	fputs("type ", stdout);
+	outs("type ");
 	emitname(t->value);
 	if (t == targ->typevalist) {
-		printf(" = align %d { %llu }\n", t->align, t->size);
+		outs(" = align ");
+		outu(t->align);
+		outs(" { ");
+		outu(t->size);
+		outs(" }\n");
 		return;
 	}
-	fputs(" = { ", stdout);
+	outs(" = { ");
 	for (m = t->u.structunion.members, off = 0; m;) {
 		if (t->kind == TYPESTRUCT) {
 			/* look for a subsequent member with a larger storage unit */
@@ -1231,24 +2201,26 @@ emittype(struct type *t)
 			}
 			off = m->offset + m->type->size;
 		} else {
-			fputs("{ ", stdout);
+			outs("{ ");
 		}
 		for (sub = m->type; sub->kind == TYPEARRAY; sub = sub->base)
 			;
 		emitclass(qbetype(sub).data, sub->value);
-		if (m->type->size > sub->size)
-			printf(" %llu", m->type->size / sub->size);
+		if (m->type->size > sub->size) {
+			outc(' ');
+			outu(m->type->size / sub->size);
+		}
 		if (t->kind == TYPESTRUCT) {
-			fputs(", ", stdout);
+			outs(", ");
 			/* skip subsequent members contained within the same storage unit */
 			do m = m->next;
 			while (m && m->offset < off);
 		} else {
-			fputs(" } ", stdout);
+			outs(" } ");
 			m = m->next;
 		}
 	}
-	puts("}");
+	outs("}\n");
 }
 
 static struct inst **
@@ -1257,26 +2229,26 @@ emitinst(struct inst **instp, struct inst **instend)
 	int op, first;
 	struct inst *inst = *instp;
 
-	putchar('\t');
+	outc('\t');
 	assert(inst->kind < countof(instname));
 	if (inst->res.kind) {
 		emitvalue(&inst->res);
-		fputs(" =", stdout);
+		outs(" =");
 		emitclass(inst->class, inst->arg[1]);
-		putchar(' ');
+		outc(' ');
 	}
-	fputs(instname[inst->kind], stdout);
-	putchar(' ');
+	outs(instname[inst->kind]);
+	outc(' ');
 	emitvalue(inst->arg[0]);
 	++instp;
 	op = inst->kind;
 	switch (op) {
 	case ICALL:
-		putchar('(');
+		outc('(');
 		for (first = 1; instp != instend; ++instp) {
 			inst = *instp;
 			if (inst->kind == IVARARG) {
-				fputs(", ...", stdout);
+				outs(", ...");
 				continue;
 			}
 			if (inst->kind != IARG)
@@ -1284,20 +2256,20 @@ emitinst(struct inst **instp, struct inst **instend)
 			if (first)
 				first = 0;
 			else
-				fputs(", ", stdout);
+				outs(", ");
 			emitclass(inst->class, inst->arg[1]);
-			putchar(' ');
+			outc(' ');
 			emitvalue(inst->arg[0]);
 		}
-		putchar(')');
+		outc(')');
 		break;
 	default:
 		if (inst->arg[1]) {
-			fputs(", ", stdout);
+			outs(", ");
 			emitvalue(inst->arg[1]);
 		}
 	}
-	putchar('\n');
+	outc('\n');
 	return instp;
 }
 
@@ -1308,29 +2280,29 @@ emitjump(struct jump *j)
 	case JUMP_NONE:
 		break;
 	case JUMP_RET:
-		fputs("\tret", stdout);
+		outs("\tret");
 		if (j->arg) {
-			fputc(' ', stdout);
+			outc(' ');
 			emitvalue(j->arg);
 		}
-		putchar('\n');
+		outc('\n');
 		break;
 	case JUMP_JMP:
-		fputs("\tjmp ", stdout);
+		outs("\tjmp ");
 		emitname(&j->blk[0]->label);
-		putchar('\n');
+		outc('\n');
 		break;
 	case JUMP_JNZ:
-		fputs("\tjnz ", stdout);
+		outs("\tjnz ");
 		emitvalue(j->arg);
-		fputs(", ", stdout);
+		outs(", ");
 		emitname(&j->blk[0]->label);
-		fputs(", ", stdout);
+		outs(", ");
 		emitname(&j->blk[1]->label);
-		putchar('\n');
+		outc('\n');
 		break;
 	case JUMP_HLT:
-		fputs("\thlt\n", stdout);
+		outs("\thlt\n");
 		break;
 	default:
 		assert(0);
@@ -1342,8 +2314,10 @@ emitfunc(struct func *f, bool global)
 {
 	struct block *b;
 	struct inst **inst, **instend;
+	struct phi *phi;
 	struct decl *p;
 	struct value *v;
+	size_t i;
 
 	if (f->end->jump.kind == JUMP_NONE) {
 		v = NULL;
@@ -1352,57 +2326,80 @@ emitfunc(struct func *f, bool global)
 			v = mkintconst(0);
 		funcret(f, v);
 	}
+	if (optflags & OPTPROMOTE)
+		promote(f);
+	if (optflags & OPTSIMPLIFY)
+		simplify(f);
 	if (global)
-		puts("export");
-	fputs("function ", stdout);
+		outs("export\n");
+	outs("function ");
 	if (f->type->base != &typevoid) {
 		emitclass(qbetype(f->type->base).base, f->type->base->value);
-		putchar(' ');
+		outc(' ');
 	}
 	emitname(f->decl->value);
-	putchar('(');
+	outc('(');
 	for (p = f->type->u.func.params, v = f->paramtemps; p; p = p->next, ++v) {
 		if (p != f->type->u.func.params)
-			fputs(", ", stdout);
+			outs(", ");
 		emitclass(qbetype(p->type).base, p->type->value);
-		putchar(' ');
+		outc(' ');
 		emitname(v);
 	}
 	if (f->type->u.func.isvararg) {
 		if (f->type->u.func.params)
-			fputs(", ", stdout);
-		fputs("...", stdout);
+			outs(", ");
+		outs("...");
 	}
-	puts(") {");
+	outs(") {\n");
 	for (b = f->start; b; b = b->next) {
 		emitname(&b->label);
-		putchar('\n');
+		outc('\n');
 		if (b->phi.res.kind) {
-			putchar('\t');
+			outc('\t');
 			emitvalue(&b->phi.res);
-			printf(" =%c phi ", b->phi.class);
+			outs(" =");
+			outc(b->phi.class);
+			outs(" phi ");
 			emitname(&b->phi.blk[0]->label);
-			putchar(' ');
+			outc(' ');
 			emitvalue(b->phi.val[0]);
-			fputs(", ", stdout);
+			outs(", ");
 			emitname(&b->phi.blk[1]->label);
-			putchar(' ');
+			outc(' ');
 			emitvalue(b->phi.val[1]);
-			putchar('\n');
+			outc('\n');
+		}
+		for (phi = b->phis; phi; phi = phi->next) {
+			outc('\t');
+			emitvalue(&phi->res);
+			outs(" =");
+			outc(phi->class);
+			outs(" phi ");
+			for (i = 0; i < phi->nval; ++i) {
+				if (i > 0)
+					outs(", ");
+				emitname(&b->pred[i]->label);
+				outc(' ');
+				emitvalue(phi->val[i]);
+			}
+			outc('\n');
 		}
 		instend = (struct inst **)((char *)b->insts.val + b->insts.len);
 		for (inst = b->insts.val; inst != instend;)
 			inst = emitinst(inst, instend);
 		emitjump(&b->jump);
 	}
-	puts("}");
+	outs("}\n");
 }
 
 static void
 dataitem(struct expr *expr, unsigned long long size)
 {
 	struct decl *decl;
-	size_t i, w;
+	const unsigned char *str;
+	char esc[4] = "\\";
+	size_t i, j, n, w;
 	unsigned c;
 
 	switch (expr->kind) {
@@ -1421,44 +2418,73 @@ dataitem(struct expr *expr, unsigned long long size)
 		if (expr->op != TADD || expr->u.binary.l->kind != EXPRUNARY || expr->u.binary.r->kind != EXPRCONST)
 			error(&tok.loc, "initializer is not a constant expression");
 		dataitem(expr->u.binary.l, 0);
-		fputs(" + ", stdout);
+		outs(" + ");
 		dataitem(expr->u.binary.r, 0);
 		break;
 	case EXPRCONST:
 		if (expr->type->prop & PROPFLOAT)
-			printf("%c_%.17g", expr->type->size == 4 ? 's' : 'd', expr->u.constant.f);
+			outflt(expr->type->size == 4 ? 's' : 'd', expr->u.constant.f);
 		else
-			printf("%llu", expr->u.constant.u);
+			outu(expr->u.constant.u);
 		break;
 	case EXPRSTRING:
 		w = expr->type->base->size;
 		if (w == 1) {
-			fputc('"', stdout);
-			for (i = 0; i < expr->u.string.size && i < size; ++i) {
-				c = ((unsigned char *)expr->u.string.data)[i];
-				if (isprint(c) && c != '"' && c != '\\')
-					putchar(c);
-				else
-					printf("\\%03o", c);
+			str = expr->u.string.data;
+			n = expr->u.string.size < size ? expr->u.string.size : size;
+			outc('"');
+			for (i = 0; i < n; i = j) {
+				/* copy printable runs in bulk, escape the rest in octal */
+				for (j = i; j < n && isprint(str[j]) && str[j] != '"' && str[j] != '\\'; ++j)
+					;
+				outn((char *)str + i, j - i);
+				if (j < n) {
+					c = str[j++];
+					esc[1] = '0' + (c >> 6);
+					esc[2] = '0' + (c >> 3 & 7);
+					esc[3] = '0' + (c & 7);
+					outn(esc, 4);
+				}
 			}
-			fputc('"', stdout);
+			outc('"');
 		} else {
 			for (i = 0; i < expr->u.string.size && i * w < size; ++i) {
 				switch (w) {
-				case 2: printf("%" PRIuLEAST16 " ", ((uint_least16_t *)expr->u.string.data)[i]); break;
-				case 4: printf("%" PRIuLEAST32 " ", ((uint_least32_t *)expr->u.string.data)[i]); break;
+				case 2: outu(((uint_least16_t *)expr->u.string.data)[i]); break;
+				case 4: outu(((uint_least32_t *)expr->u.string.data)[i]); break;
 				default: assert(0);
 				}
+				outc(' ');
 			}
 		}
-		if (i * w < size)
-			printf(", z %llu", size - (unsigned long long)i * w);
+		if (i * w < size) {
+			outs(", z ");
+			outu(size - (unsigned long long)i * w);
+		}
 		break;
 	default:
 		error(&tok.loc, "initializer is not a constant expression");
 	}
 }
 
+/*
+begin a data item of the given type, adding it to the previous
+item list if that has the same type
+*/
+static void
+datastart(int *prev, int type)
+{
+	if (*prev == type) {
+		outc(' ');
+		return;
+	}
+	if (*prev)
+		outs(", ");
+	outc(type);
+	outc(' ');
+	*prev = type;
+}
+
 void
 emitdata(struct decl *d, struct init *init)
 {
@@ -1466,18 +2492,20 @@ emitdata(struct decl *d, struct init *init)
 	struct type *t;
 	unsigned long long offset = 0, start, end, bits = 0;
 	size_t i;
-	int align;
+	int align, prev = 0;
 
 	align = d->u.obj.align;
 	for (cur = init; cur; cur = cur->next)
 		cur->expr = eval(cur->expr);
 	if (d->u.obj.storage == SDTHREAD)
-		fputs("thread ", stdout);
+		outs("thread ");
 	if (d->linkage == LINKEXTERN)
-		fputs("export ", stdout);
-	fputs("data ", stdout);
+		outs("export ");
+	outs("data ");
 	emitname(d->value);
-	printf(" = align %d { ", align);
+	outs(" = align ");
+	outu(align);
+	outs(" { ");
 
 	while (init) {
 		cur = init;
@@ -1499,19 +2527,29 @@ emitdata(struct decl *d, struct init *init)
 		start = cur->start + cur->bits.before / 8;
 		end = cur->end - (cur->bits.after + 7) / 8;
 		if (offset < start && bits) {
-			printf("b %u, ", (unsigned)bits);  /* unfinished byte from previous bit-field */
+			/* unfinished byte from previous bit-field */
+			datastart(&prev, 'b');
+			outu((unsigned)bits);
 			++offset;
 			bits = 0;
 		}
-		if (offset < start)
-			printf("z %llu, ", start - offset);
+		/* zero scalars are merged into the surrounding zero span */
+		if (!cur->bits.before && !cur->bits.after && cur->expr->kind == EXPRCONST && cur->expr->u.constant.u == 0)
+			continue;
+		if (offset < start) {
+			datastart(&prev, 'z');
+			outu(start - offset);
+			prev = -1;
+		}
 		if (cur->bits.before || cur->bits.after) {
 			/* little-endian target specific */
 			assert(cur->expr->type->prop & PROPINT);
 			assert(cur->expr->kind == EXPRCONST);
 			bits |= cur->expr->u.constant.u << cur->bits.before % 8;
-			for (offset = start; offset < end; ++offset, bits >>= 8)
-				printf("b %u, ", (unsigned)bits & 0xff);
+			for (offset = start; offset < end; ++offset, bits >>= 8) {
+				datastart(&prev, 'b');
+				outu(bits & 0xff);
+			}
 			/*
 			clear the upper `after` bits in the last byte,
 			or all bits when `after` is 0 (we ended on a
@@ -1522,18 +2560,89 @@ emitdata(struct decl *d, struct init *init)
 			t = cur->expr->type;
 			if (t->kind == TYPEARRAY)
 				t = t->base;
-			printf("%c ", qbetype(t).data);
+			if (cur->expr->kind == EXPRSTRING)
+				prev = prev ? -1 : 0;
+			datastart(&prev, qbetype(t).data);
 			dataitem(cur->expr, cur->end - cur->start);
-			fputs(", ", stdout);
+			/* strings may end with a zero span */
+			if (cur->expr->kind == EXPRSTRING)
+				prev = -1;
 		}
 		offset = end;
 	}
 	if (bits) {
-		printf("b %u, ", (unsigned)bits);
+		datastart(&prev, 'b');
+		outu((unsigned)bits);
 		++offset;
 	}
 	assert(offset <= d->type->size);
-	if (offset < d->type->size)
-		printf("z %llu ", d->type->size - offset);
-	puts("}");
+	if (offset < d->type->size) {
+		datastart(&prev, 'z');
+		outu(d->type->size - offset);
+		outc(' ');
+	} else if (prev) {
+		outs(", ");
+	}
+	outs("}\n");
+}
+
+/* precompiled headers */
+
+void
+pchputvalue(struct pchwriter *w, struct value *v)
+{
+	if (!v) {
+		pchputint(&w->body, VALUE_NONE);
+		return;
+	}
+	/* only globals and types outlive the declaration that created them */
+	assert((v->kind & ~(VALUE_THREAD | VALUE_QUOTE)) == VALUE_GLOBAL || v->kind == VALUE_TYPE);
+	pchputint(&w->body, v->kind);
+	pchputint(&w->body, v->id);
+	pchputref(w, v->u.name);
+}
+
+struct value *
+pchgetvalue(struct pchreader *r)
+{
+	struct value *v;
+	unsigned long long kind;
+
+	kind = pchgetint(r);
+	if (kind == VALUE_NONE)
+		return NULL;
+	if ((kind & ~(VALUE_THREAD | VALUE_QUOTE)) != VALUE_GLOBAL && kind != VALUE_TYPE)
+		pchcorrupt(r);
+	v = xmalloc(sizeof(*v));
+	v->kind = kind;
+	v->id = pchgetint(r);
+	v->u.name = pchgetref(r);
+	if (!v->u.name && kind != VALUE_TYPE)
+		pchcorrupt(r);
+	return v;
+}
+
+/* write the IDs given out so far and the IL emitted for the header */
+void
+emitwritepch(struct pchwriter *w)
+{
+	emitflush();
+	pchputint(&w->body, blockid);
+	pchputint(&w->body, globalid);
+	pchputint(&w->body, typeid);
+	pchputint(&w->body, out.captured.len);
+	arrayaddbuf(&w->body, out.captured.val, out.captured.len);
+}
+
+void
+emitreadpch(struct pchreader *r)
+{
+	size_t n;
+
+	blockid = pchgetint(r);
+	globalid = pchgetint(r);
+	typeid = pchgetint(r);
+	n = pchgetcount(r);
+	outn((char *)r->pos, n);
+	r->pos += n;
 }
@@ -1,6 +1,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,12 +18,18 @@ struct scanner {
 	bool usebuf;
 	bool sawspace;
 	FILE *file;
+	/* path the file was opened with, unaffected by #line */
+	const char *name;
+	/* contents of the input file, terminated by a '\0' sentinel */
+	unsigned char *data, *pos, *end;
 	struct location loc;
 	struct buffer buf;
 	struct scanner *next;
 };
 
 static struct scanner *scanner;
+/* number of open files */
+static size_t depth;
 
 static void
 bufadd(struct buffer *b, int c)
@@ -34,6 +41,18 @@ bufadd(struct buffer *b, int c)
 	b->str[b->len++] = c;
 }
 
+static void
+bufaddn(struct buffer *b, const unsigned char *s, size_t n)
+{
+	if (b->cap - b->len < n) {
+		do b->cap = b->cap ? b->cap * 2 : 1<<8;
+		while (b->cap - b->len < n);
+		b->str = xreallocarray(b->str, b->cap, 1);
+	}
+	memcpy(b->str + b->len, s, n);
+	b->len += n;
+}
+
 static char *
 bufget(struct buffer *b)
 {
@@ -50,28 +69,73 @@ bufget(struct buffer *b)
 static void
 nextchar(struct scanner *s)
 {
-	int c;
-
 	if (s->usebuf)
 		bufadd(&s->buf, s->chr);
 	for (;;) {
-		s->chr = getc(s->file);
+		if (s->pos == s->end) {
+			s->chr = EOF;
+			++s->loc.col;
+			break;
+		}
+		s->chr = *s->pos++;
 		if (s->chr == '\n') {
 			++s->loc.line, s->loc.col = 0;
 			break;
 		}
 		++s->loc.col;
-		if (s->chr != '\\')
+		if (s->chr != '\\' || *s->pos != '\n')
 			break;
-		c = getc(s->file);
-		if (c != '\n') {
-			ungetc(c, s->file);
-			break;
-		}
+		++s->pos;
 		++s->loc.line, s->loc.col = 0;
 	}
 }
 
+/*
+move to the last of the next n characters, none of which may be a
+newline or a backslash
+
+This is the fast path for runs of characters that need no special
+handling, so that nextchar() only has to deal with their ends and
+with line splices.
+*/
+static void
+advance(struct scanner *s, size_t n)
+{
+	if (n == 0)
+		return;
+	if (s->usebuf) {
+		bufadd(&s->buf, s->chr);
+		bufaddn(&s->buf, s->pos, n - 1);
+	}
+	s->chr = s->pos[n - 1];
+	s->pos += n;
+	s->loc.col += n;
+}
+
+/* length of the run of horizontal whitespace at the current position */
+static size_t
+spacespan(struct scanner *s)
+{
+	static const uint64_t ones = 0x0101010101010101, high = 0x8080808080808080;
+	unsigned char *pos;
+	uint64_t w, x, y;
+
+	/* check 8 bytes at a time for spaces and tabs */
+	for (pos = s->pos; s->end - pos >= 8; pos += 8) {
+		memcpy(&w, pos, 8);
+		x = w ^ ' ' * ones;
+		y = w ^ '\t' * ones;
+		/* set the high bit of each byte that is zero in x or y */
+		x = ~((x & ~high) + ~high | x) & high;
+		y = ~((y & ~high) + ~high | y) & high;
+		if ((x | y) != high)
+			break;
+	}
+	while (*pos == ' ' || *pos == '\t' || *pos == '\f' || *pos == '\v')
+		++pos;
+	return pos - s->pos;
+}
+
 static int
 op2(struct scanner *s, int t1, int t2)
 {
@@ -122,9 +186,15 @@ op4(struct scanner *s, int t1, int t2, int t3, int t4)
 static int
 ident(struct scanner *s)
 {
+	unsigned char *pos;
+
 	s->usebuf = true;
-	while (isalnum(s->chr) || s->chr == '_')
+	while (isalnum(s->chr) || s->chr == '_') {
+		for (pos = s->pos; isalnum(*pos) || *pos == '_'; ++pos)
+			;
+		advance(s, pos - s->pos);
 		nextchar(s);
+	}
 
 	return TIDENT;
 }
@@ -139,6 +209,7 @@ static enum tokenkind
 number(struct scanner *s)
 {
 	bool allowsign = false;
+	unsigned char *pos;
 
 	s->usebuf = true;
 	for (;;) {
@@ -166,6 +237,10 @@ number(struct scanner *s)
 			if (!isalnum(s->chr) && s->chr != '_')
 				goto done;
 			allowsign = false;
+			/* skip ahead to the next exponent, sign, or separator */
+			for (pos = s->pos; isalnum(*pos) && (*pos | 0x20) != 'e' && (*pos | 0x20) != 'p' || *pos == '_' || *pos == '.'; ++pos)
+				;
+			advance(s, pos - s->pos);
 		}
 	}
 done:
@@ -214,6 +289,7 @@ charconst(struct scanner *s)
 		case EOF:
 			error(&s->loc, "EOF in character constant");
 		default:
+			advance(s, strcspn((char *)s->pos, "'\\\n"));
 			nextchar(s);
 			break;
 		}
@@ -238,6 +314,7 @@ stringlit(struct scanner *s)
 		case EOF:
 			error(&s->loc, "EOF in string literal");
 		default:
+			advance(s, strcspn((char *)s->pos, "\"\\\n"));
 			nextchar(s);
 			break;
 		}
@@ -251,12 +328,16 @@ comment(struct scanner *s)
 
 	switch (s->chr) {
 	case '/':  /* C++-style comment */
-		do nextchar(s);
-		while (s->chr != '\n' && s->chr != EOF);
+		do {
+			advance(s, strcspn((char *)s->pos, "\n\\"));
+			nextchar(s);
+		} while (s->chr != '\n' && s->chr != EOF);
 		break;
 	case '*':  /* C-style comment */
 		nextchar(s);
 		do {
+			if (s->chr != '*')
+				advance(s, strcspn((char *)s->pos, "*\n\\"));
 			last = s->chr;
 			nextchar(s);
 			if (s->chr == EOF)
@@ -285,6 +366,7 @@ again:
 	case '\f':
 	case '\v':
 		s->sawspace = true;
+		advance(s, spacespan(s));
 		nextchar(s);
 		goto again;
 	case '!':
@@ -360,7 +442,8 @@ again:
 		oldloc = s->loc;
 		nextchar(s);
 		if (s->chr != '.') {
-			ungetc(s->chr, s->file);
+			if (s->chr != EOF)
+				--s->pos;
 			s->loc = oldloc;
 			s->chr = '.';
 			return TPERIOD;
@@ -410,6 +493,48 @@ again:
 	}
 }
 
+/* read the entire input file into memory */
+static void
+scanread(struct scanner *s)
+{
+	unsigned char *data;
+	size_t len, cap, n;
+	long start, end;
+
+	cap = 1<<16;
+	/* use the size of the file if it is seekable */
+	start = ftell(s->file);
+	if (start >= 0 && fseek(s->file, 0, SEEK_END) == 0) {
+		end = ftell(s->file);
+		if (fseek(s->file, start, SEEK_SET) != 0)
+			fatal("seek %s:", s->loc.file);
+		if (end > start)
+			cap = end - start + 1;
+	}
+	data = xmalloc(cap);
+	len = 0;
+	for (;;) {
+		n = fread(data + len, 1, cap - len, s->file);
+		len += n;
+		if (len < cap) {
+			if (ferror(s->file))
+				fatal("read %s:", s->loc.file);
+			if (feof(s->file))
+				break;
+			continue;
+		}
+		cap *= 2;
+		data = xreallocarray(data, cap, 1);
+	}
+	data[len] = '\0';
+	fclose(s->file);
+	s->file = NULL;
+	s->data = data;
+	s->pos = data;
+	s->end = data + len;
+	nextchar(s);
+}
+
 void
 scanfrom(const char *name, FILE *file)
 {
@@ -417,27 +542,42 @@ scanfrom(const char *name, FILE *file)
 
 	s = xmalloc(sizeof(*s));
 	s->file = file;
+	s->data = NULL;
 	s->buf.str = NULL;
 	s->buf.len = 0;
 	s->buf.cap = 0;
 	s->usebuf = false;
+	s->sawspace = false;
+	s->name = name;
 	s->loc.file = name;
 	s->loc.line = 1;
 	s->loc.col = 0;
 	s->next = scanner;
 	if (file)
-		nextchar(s);
+		scanread(s);
 	scanner = s;
+	++depth;
+}
+
+/* scan a string, which must be allocated with malloc */
+void
+scantext(const char *name, char *text)
+{
+	scanfrom(name, NULL);
+	scanner->data = (unsigned char *)text;
+	scanner->pos = scanner->data;
+	scanner->end = scanner->data + strlen(text);
+	nextchar(scanner);
 }
 
 void
 scanopen(void)
 {
-	if (!scanner->file) {
+	if (!scanner->data) {
 		scanner->file = fopen(scanner->loc.file, "r");
 		if (!scanner->file)
 			fatal("open %s:", scanner->loc.file);
-		nextchar(scanner);
+		scanread(scanner);
 	}
 }
 
@@ -447,27 +587,55 @@ scansetloc(struct location loc)
 	scanner->loc = loc;
 }
 
+/* close the current file and return to the one that included it */
 static void
 scanclose(void)
 {
-	fclose(scanner->file);
-	free(scanner->buf.str);
-	free(scanner);
+	struct scanner *s = scanner;
+
+	scanner = s->next;
+	--depth;
+	free(s->data);
+	free(s->buf.str);
+	free(s);
+}
+
+const char *
+scanname(void)
+{
+	return scanner->name;
+}
+
+size_t
+scandepth(void)
+{
+	return depth;
 }
 
 void
 scan(struct token *t)
 {
+	bool newline;
+
 	scanner->sawspace = false;
 	for (;;) {
 		t->kind = scankind(scanner, &t->loc);
 		if (t->kind != TEOF || !scanner->next)
 			break;
+		newline = scanner->end > scanner->data && scanner->end[-1] != '\n';
 		scanclose();
-		scanner = scanner->next;
 		scanopen();
+		/* end the last line of a file that is missing a newline */
+		if (newline) {
+			t->kind = TNEWLINE;
+			break;
+		}
 	}
-	if (scanner->usebuf) {
+	if (t->kind == TIDENT) {
+		t->lit = intern((char *)scanner->buf.str, scanner->buf.len);
+		scanner->buf.len = 0;
+		scanner->usebuf = false;
+	} else if (scanner->usebuf) {
 		t->lit = bufget(&scanner->buf);
 		scanner->usebuf = false;
 	} else {
@@ -476,3 +644,110 @@ scan(struct token *t)
 	t->space = scanner->sawspace;
 	t->hide = false;
 }
+
+/*
+scan a header name, including its delimiters, or return NULL if the
+next token does not start with '<' or '"'
+*/
+char *
+scanheadername(struct location *loc)
+{
+	struct scanner *s = scanner;
+	int end;
+
+	while (s->chr == ' ' || s->chr == '\t' || s->chr == '\f' || s->chr == '\v')
+		nextchar(s);
+	*loc = s->loc;
+	switch (s->chr) {
+	case '<': end = '>'; break;
+	case '"': end = '"'; break;
+	default: return NULL;
+	}
+	s->usebuf = true;
+	do {
+		nextchar(s);
+		if (s->chr == '\n' || s->chr == EOF)
+			error(loc, "unterminated header name");
+	} while (s->chr != end);
+	nextchar(s);
+	s->usebuf = false;
+	return bufget(&s->buf);
+}
+
+/* read the rest of the line as text, without leading or trailing whitespace */
+char *
+scanline(void)
+{
+	struct scanner *s = scanner;
+
+	while (s->chr == ' ' || s->chr == '\t' || s->chr == '\f' || s->chr == '\v')
+		nextchar(s);
+	s->usebuf = true;
+	while (s->chr != '\n' && s->chr != EOF)
+		nextchar(s);
+	s->usebuf = false;
+	while (s->buf.len > 0 && isspace(s->buf.str[s->buf.len - 1]))
+		--s->buf.len;
+	return bufget(&s->buf);
+}
+
+/*
+skip to the next line that starts with '#', and past the '#', returning
+false at the end of the file
+
+This is used for groups excluded by conditional directives, which only
+need to be split into lines, so literals with no closing quote are
+allowed.
+*/
+bool
+scanskip(bool bol)
+{
+	struct scanner *s = scanner;
+	int quote;
+
+	for (;;) {
+		switch (s->chr) {
+		case EOF:
+			return false;
+		case '\n':
+			bol = true;
+			nextchar(s);
+			break;
+		case ' ':
+		case '\t':
+		case '\f':
+		case '\v':
+			advance(s, spacespan(s));
+			nextchar(s);
+			break;
+		case '#':
+			nextchar(s);
+			if (bol)
+				return true;
+			break;
+		case '/':
+			nextchar(s);
+			if (!comment(s))
+				bol = false;
+			break;
+		case '"':
+		case '\'':
+			bol = false;
+			quote = s->chr;
+			nextchar(s);
+			while (s->chr != quote && s->chr != '\n' && s->chr != EOF) {
+				if (s->chr == '\\')
+					nextchar(s);
+				if (s->chr != '\n')
+					nextchar(s);
+			}
+			if (s->chr == quote)
+				nextchar(s);
+			break;
+		default:
+			bol = false;
+			advance(s, strcspn((char *)s->pos, "\n\\/\"'#"));
+			nextchar(s);
+		}
+	}
+}
@@ -27,9 +27,11 @@ scopeinit(void)
 	static struct decl valist;
 	struct decl *d;
 
-	for (d = builtins; d < builtins + countof(builtins); ++d)
+	for (d = builtins; d < builtins + countof(builtins); ++d) {
+		d->name = intern(d->name, strlen(d->name));
 		scopeputdecl(&filescope, d);
-	valist.name = "__builtin_va_list";
+	}
+	valist.name = intern("__builtin_va_list", 17);
 	valist.kind = DECLTYPE;
 	valist.type = targ->typevalist;
 	scopeputdecl(&filescope, &valist);
@@ -71,7 +73,7 @@ scopegetdecl(struct scope *s, const char *name, bool recurse)
 	struct decl *d;
 	struct mapkey k;
 
-	mapkey(&k, name, strlen(name));
+	atomkey(&k, name);
 	do {
 		d = s->decls.len ? mapget(&s->decls, &k) : NULL;
 		s = s->parent;
@@ -86,7 +88,7 @@ scopegettag(struct scope *s, const char *name, bool recurse)
 	struct type *t;
 	struct mapkey k;
 
-	mapkey(&k, name, strlen(name));
+	atomkey(&k, name);
 	do {
 		t = s->tags.len ? mapget(&s->tags, &k) : NULL;
 		s = s->parent;
@@ -102,7 +104,7 @@ scopeputdecl(struct scope *s, struct decl *d)
 
 	if (!s->decls.len)
 		mapinit(&s->decls, 32);
-	mapkey(&k, d->name, strlen(d->name));
+	atomkey(&k, d->name);
 	*mapput(&s->decls, &k) = d;
 }
 
@@ -113,6 +115,6 @@ scopeputtag(struct scope *s, const char *name, struct type *t)
 
 	if (!s->tags.len)
 		mapinit(&s->tags, 32);
-	mapkey(&k, name, strlen(name));
+	atomkey(&k, name);
 	*mapput(&s->tags, &k) = t;
 }
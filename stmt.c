@@ -91,7 +91,6 @@ stmt(struct func *f, struct scope *s)
 	default:
 		e = expr(s);
 		v = funcexpr(f, e);
-		delexpr(e);
 		expect(TSEMICOLON, "after expression statement");
 		break;
 
@@ -107,7 +106,6 @@ stmt(struct func *f, struct scope *s)
 		b[0] = mkblock("if_true");
 		b[1] = mkblock("if_false");
 		funcbranch(f, e, b[0], b[1]);
-		delexpr(e);
 		expect(TRPAREN, "after expression");
 
 		funclabel(f, b[0]);
@@ -224,11 +222,8 @@ stmt(struct func *f, struct scope *s)
 		expect(TLPAREN, "after 'for'");
 		s = mkscope(s);
 		if (!decl(s, f)) {
-			if (tok.kind != TSEMICOLON) {
-				e = expr(s);
-				funcexpr(f, e);
-				delexpr(e);
-			}
+			if (tok.kind != TSEMICOLON)
+				funcexpr(f, expr(s));
 			expect(TSEMICOLON, NULL);
 		}
 
@@ -244,7 +239,6 @@ stmt(struct func *f, struct scope *s)
 			if (!(t->prop & PROPSCALAR))
 				error(&tok.loc, "controlling expression of loop must have scalar type");
 			funcbranch(f, e, b[1], b[3]);
-			delexpr(e);
 		}
 		expect(TSEMICOLON, NULL);
 		e = tok.kind == TRPAREN ? NULL : expr(s);
@@ -258,10 +252,8 @@ stmt(struct func *f, struct scope *s)
 		s = delscope(s);
 
 		funclabel(f, b[2]);
-		if (e) {
+		if (e)
 			funcexpr(f, e);
-			delexpr(e);
-		}
 		funcjmp(f, b[0]);
 		funclabel(f, b[3]);
 		s = delscope(s);
@@ -294,7 +286,6 @@ stmt(struct func *f, struct scope *s)
 		if (t->base != &typevoid) {
 			e = exprassign(expr(s), t->base);
 			v = funcexpr(f, e);
-			delexpr(e);
 		} else {
 			v = NULL;
 		}
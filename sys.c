@@ -0,0 +1,102 @@
+/*
+Interfaces to the host system beyond ISO C. These are used when the
+host is known to provide them, and otherwise fall back to what C99
+alone allows.
+*/
+#if defined(__unix__)
+#define _XOPEN_SOURCE 700
+#define HAVE_POSIX 1
+#elif defined(__APPLE__)
+/* macOS provides POSIX by default, and hides st_mtimespec if _XOPEN_SOURCE is defined */
+#define HAVE_POSIX 1
+#endif
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_POSIX
+#include <sys/stat.h>
+#endif
+#include "util.h"
+#include "cc.h"
+
+#ifdef HAVE_POSIX
+#ifdef __APPLE__
+#define MTIMENSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define MTIMENSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+static void
+statinfo(const struct stat *st, struct fileinfo *info)
+{
+	info->hasid = true;
+	info->dev = st->st_dev;
+	info->ino = st->st_ino;
+	info->mtime = st->st_mtime;
+	info->mtimensec = MTIMENSEC(st);
+	info->size = st->st_size;
+}
+#endif
+
+/* get information about an open file */
+void
+fileinfo(FILE *f, const char *path, struct fileinfo *info)
+{
+#ifdef HAVE_POSIX
+	struct stat st;
+
+	if (fstat(fileno(f), &st) != 0)
+		fatal("stat %s:", path);
+	statinfo(&st, info);
+#else
+	info->hasid = false;
+	info->dev = 0;
+	info->ino = 0;
+	info->mtime = 0;
+	info->mtimensec = 0;
+	info->size = 0;
+#endif
+}
+
+/* get information about a file by name, returning false if it can't be opened */
+bool
+pathinfo(const char *path, struct fileinfo *info)
+{
+#ifdef HAVE_POSIX
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		return false;
+	statinfo(&st, info);
+	return true;
+#else
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return false;
+	fileinfo(f, path, info);
+	fclose(f);
+	return true;
+#endif
+}
+
+/* get an absolute path for a file, or a copy of the path if the host can't resolve it */
+char *
+fullpath(const char *path)
+{
+	char *abs;
+#ifdef HAVE_POSIX
+	abs = realpath(path, NULL);
+	if (!abs)
+		fatal("realpath %s:", path);
+#else
+	size_t len;
+
+	len = strlen(path) + 1;
+	abs = xmalloc(len);
+	memcpy(abs, path, len);
+#endif
+	return abs;
+}
@@ -18,6 +18,7 @@ static const struct target alltargs[] = {
 			},
 		},
 		.signedchar = 1,
+		.macros = (const char *const []){"__x86_64__", "__x86_64", "__amd64__", "__amd64", NULL},
 	},
 	{
 		.name = "aarch64",
@@ -27,6 +28,7 @@ static const struct target alltargs[] = {
 			.u.structunion.tag = "va_list",
 		},
 		.typewchar = &typeuint,
+		.macros = (const char *const []){"__aarch64__", NULL},
 	},
 	{
 		.name = "riscv64",
@@ -36,6 +38,7 @@ static const struct target alltargs[] = {
 			.base = &typevoid,
 		},
 		.typewchar = &typeint,
+		.macros = (const char *const []){"__riscv", "__riscv_xlen=64", "__riscv_flen=64", "__riscv_float_abi_double", NULL},
 	},
 };
 
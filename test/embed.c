@@ -0,0 +1,18 @@
+unsigned char a[] = {
+#embed "embed.dat"
+};
+char b[8] = {
+#embed "embed.dat" limit(3) suffix(, 'z')
+};
+int c[] = {
+#embed "embed.dat" prefix(1,) limit(2)
+};
+char d[] = {
+#embed "/dev/null" prefix(1,) if_empty(2)
+};
+struct {
+	char x[2];
+	int y;
+} s = {
+#embed "embed.dat" limit(3)
+};
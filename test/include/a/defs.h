@@ -0,0 +1,2 @@
+#define HDR "preprocess-include-macro.h"
+#define S(x) #x
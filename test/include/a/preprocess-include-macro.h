@@ -0,0 +1 @@
+wrong
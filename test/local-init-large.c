@@ -0,0 +1,5 @@
+void f(void) {
+	char small[16] = {0};
+	long medium[16] = {1};
+	char large[65536] = {2};
+}
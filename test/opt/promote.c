@@ -0,0 +1,23 @@
+int g(int *);
+int f(int n, char c) {
+	int s = 0, t, u = 1;
+	volatile int v = 2;
+	for (int i = 0; i < n; ++i) {
+		if (i & 1)
+			s += c;
+		else
+			t = s;
+	}
+	c = s;
+	return s + t + c + g(&u) + v;
+}
+int h(int c) {
+	int x = 1;
+	if (c)
+		x = 3;
+	goto L;
+M:
+	x = 2;
+L:
+	return x;
+}
@@ -0,0 +1,14 @@
+int g(int);
+int f(int x) {
+	while (x) {
+		if (x > 2)
+			continue;
+		else
+			x = g(x);
+	}
+	if (x)
+		return 1;
+	else
+		return 2;
+	return g(3);
+}
@@ -0,0 +1,37 @@
+#ifndef HEADER_H
+#define HEADER_H
+#include "inner.h"
+#define SQUARE(x) ((x) * (x))
+#define N 3
+typedef __builtin_va_list va_list;
+enum color {
+	RED,
+	GREEN = 4,
+	BLUE,
+};
+typedef enum color color;
+struct point {
+	int x, y;
+};
+struct flags {
+	unsigned a : 3, b : 5;
+	struct flags *next;
+};
+union number {
+	long i;
+	double f;
+};
+int counter;
+extern int table[N];
+static int
+area(struct point p)
+{
+	return SQUARE(p.x) + p.y * N;
+}
+static inline const char *
+name(void)
+{
+	return "header";
+}
+int sum(int, ...);
+#endif
@@ -0,0 +1,33 @@
+#include "header.h"
+#include "inner.h"
+int counter = 1;
+int table[N] = {1, 2, 3};
+inner
+f(void)
+{
+	struct point p = {N, 2};
+	return area(p) + SQUARE(N);
+}
+int
+g(struct flags *fl, union number *n, color c)
+{
+	return fl->b + fl->next->a + n->i + (c == BLUE) + table[GREEN - 2];
+}
+const char *
+h(void)
+{
+	name();
+	return "header";
+}
+int
+sum(int n, ...)
+{
+	va_list ap;
+	int s;
+
+	__builtin_va_start(ap, n);
+	for (s = 0; n > 0; --n)
+		s += __builtin_va_arg(ap, int);
+	__builtin_va_end(ap);
+	return s;
+}
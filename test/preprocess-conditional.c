@@ -0,0 +1,30 @@
+#define A 1
+#define F(x) x
+#if A
+if
+#elif 1/0
+#else
+#endif
+#if 0
+# if garbage '
+#  error
+# endif
+don't
+#elif F(2) == 2 && defined A && !defined(B)
+elif
+#endif
+#ifdef B
+#elifndef B
+elifndef
+#endif
+#if -1 < 0u
+#elif (-1 >> 63) == -1 && 'a' == 97 && ~0u == 18446744073709551615u
+unsigned
+#endif
+#if 1 ? 2 : 1/0
+conditional
+#endif
+#if 0
+#else
+else
+#endif
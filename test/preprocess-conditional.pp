@@ -0,0 +1,6 @@
+if
+elif
+elifndef
+unsigned
+conditional
+else
@@ -0,0 +1,5 @@
+#if 0
+#error not reached
+#endif
+#warning this is only a warning
+#error don't "stop" here
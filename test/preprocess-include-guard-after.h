@@ -0,0 +1,5 @@
+#ifndef GUARD_AFTER
+#define GUARD_AFTER
+inside
+#endif
+after
@@ -0,0 +1,6 @@
+#ifndef GUARD_ELSE
+#define GUARD_ELSE
+inside
+#else
+else
+#endif
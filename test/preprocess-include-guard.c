@@ -0,0 +1,9 @@
+#include "preprocess-include-guard.h"
+#include "preprocess-include-guard.h"
+#undef GUARD
+#include "preprocess-include-guard.h"
+#include "preprocess-include-guard.h"
+#include "preprocess-include-guard-after.h"
+#include "preprocess-include-guard-after.h"
+#include "preprocess-include-guard-else.h"
+#include "preprocess-include-guard-else.h"
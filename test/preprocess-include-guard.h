@@ -0,0 +1,5 @@
+/* only comments and whitespace outside the guard */
+#ifndef GUARD
+#define GUARD
+guarded
+#endif
@@ -0,0 +1,8 @@
+guarded
+ 
+guarded
+inside
+after
+after
+inside
+else
@@ -0,0 +1,4 @@
+#include "include/a/defs.h"
+/* names are looked up relative to this file, not the one defining the macro */
+#include HDR
+#include S(preprocess-include-macro.h)
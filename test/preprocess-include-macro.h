@@ -0,0 +1 @@
+right
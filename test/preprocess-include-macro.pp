@@ -0,0 +1,2 @@
+right
+right
@@ -0,0 +1,6 @@
+#include "preprocess-include.h"
+#define H "preprocess-include.h"
+#include H
+#if __has_include("preprocess-include.h") && !__has_include(<nonexistent.h>)
+has_include
+#endif
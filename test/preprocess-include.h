@@ -0,0 +1,4 @@
+#ifndef INCLUDED
+#define INCLUDED
+included
+#endif
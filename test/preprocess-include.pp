@@ -0,0 +1,2 @@
+included
+has_include
@@ -0,0 +1,13 @@
+#define CAT(a, b) a ## b
+#define XCAT(a, b) CAT(a, b)
+#define N 1
+CAT(x, N) XCAT(x, N)
+CAT(+, =) CAT(<<, =) CAT(-, >)
+CAT(1, e) CAT(1e, +) CAT(1, .5) CAT(0x, 1p-1)
+CAT(L, "s") CAT(u8, 'c')
+#define OBJ a ## b
+OBJ
+#define ID(x) x
+#define F(x) f x
+#define P(a, b) a ## b ID(b)
+CAT(x, F(1)) P(k, P(l, m))
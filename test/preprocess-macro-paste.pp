@@ -0,0 +1,6 @@
+xN x1
++= <<= ->
+1e 1e+ 1.5 0x1p-1
+L"s" u8'c'
+ab
+xF(1) kP(l, m) lm m
@@ -0,0 +1,3 @@
+#include "preprocess-pragma-once.h"
+#include "../test/preprocess-pragma-once.h"
+end
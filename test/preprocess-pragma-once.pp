@@ -0,0 +1,2 @@
+once
+end
@@ -0,0 +1,14 @@
+#if __STDC__ == 1 && __STDC_VERSION__ >= 201112L && __STDC_HOSTED__
+stdc
+#endif
+#if defined(__x86_64__) && __SIZEOF_LONG__ == 8 && __CHAR_BIT__ == 8
+x86_64
+#endif
+#define LINE __LINE__
+#define F(x) x
+LINE __FILE__ F(__LINE__)
+#line 100 "other.c"
+__LINE__ __FILE__
+#ifdef __DATE__
+date
+#endif
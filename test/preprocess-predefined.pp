@@ -0,0 +1,5 @@
+stdc
+x86_64
+9 "test/preprocess-predefined.c" 9
+100 "other.c"
+date
@@ -0,0 +1 @@
+char p[] = "x ## y";
@@ -0,0 +1,2 @@
+int j[] = { 123, 45, 67, 89,
+ 10, 11, 12, };
@@ -0,0 +1,12 @@
+struct medium {
+	long x[16];
+} m1, m2;
+
+struct large {
+	long x[17];
+} l1, l2;
+
+void f(void) {
+	m1 = m2;
+	l1 = l2;
+}
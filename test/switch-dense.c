@@ -0,0 +1,14 @@
+int x;
+int main(void) {
+	switch (x) {
+	case 1: return 1;
+	case 2: return 2;
+	case 3: return 3;
+	case 5: return 5;
+	case 6:
+	case 7: return 7;
+	case 100: return 100;
+	case 200: return 200;
+	default: return 0;
+	}
+}
@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <iso646.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+long limits[] = {
+	CHAR_BIT, SCHAR_MAX, UCHAR_MAX, SHRT_MAX, INT_MAX, LONG_MAX, LLONG_MIN,
+	MB_LEN_MAX, INT64_MAX, INTPTR_MAX, SIZE_MAX, WCHAR_MAX, WCHAR_MIN,
+	EOF, BUFSIZ, FLT_DIG, DBL_MANT_DIG, O_RDONLY, O_CREAT, SIGINT, EINTR,
+};
+size_t sizes[] = {
+	sizeof(struct stat), sizeof(fpos_t), sizeof(jmp_buf), sizeof(va_list),
+	sizeof(pthread_mutex_t), sizeof(max_align_t), alignof(max_align_t),
+	offsetof(struct stat, st_size), sizeof(wint_t), sizeof(off_t),
+};
+double floats[] = {DBL_MAX, DBL_MIN, DBL_EPSILON, FLT_MAX, HUGE_VAL};
+
+int
+f(int c)
+{
+	assert(c >= 0);
+	return isalpha(c) + toupper(c) + errno + getc(stdin) + (stdout != NULL);
+}
@@ -18,11 +18,18 @@ const char *tokstr[] = {
 void
 tokenprint(const struct token *t)
 {
+	const struct stringlit *data;
 	const char *str;
+	size_t i;
 
 	if (t->space)
 		fputc(' ', stdout);
 	switch (t->kind) {
+	case TEMBED:
+		data = (struct stringlit *)t->lit;
+		for (i = 0; i < data->size; ++i)
+			printf(i ? ",%d" : "%d", ((unsigned char *)data->data)[i]);
+		return;
 	case TIDENT:
 	case TNUMBER:
 	case TCHARCONST:
@@ -96,3 +103,14 @@ void error(const struct location *loc, const char *fmt, ...)
 	putc('\n', stderr);
 	exit(1);
 }
+
+void warning(const struct location *loc, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s:%zu:%zu: warning: ", loc->file, loc->line, loc->col);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	putc('\n', stderr);
+}
@@ -8,6 +8,7 @@ TOKEN(TIDENT,         NULL)
 TOKEN(TNUMBER,        NULL)
 TOKEN(TCHARCONST,     NULL)
 TOKEN(TSTRINGLIT,     NULL)
+TOKEN(TEMBED,         NULL)  /* data of an #embed directive */
 
 /* punctuators */
 TOKEN(TLBRACK,        "[")
@@ -48,7 +48,7 @@ mktype(enum typekind kind, enum typeprop prop)
 {
 	struct type *t;
 
-	t = xmalloc(sizeof(*t));
+	t = arenaalloc(&permarena, sizeof(*t));
 	t->kind = kind;
 	t->prop = prop;
 	t->value = NULL;
@@ -280,7 +280,7 @@ typemember(struct type *t, const char *name, unsigned long long *offset)
 	assert(t->kind == TYPESTRUCT || t->kind == TYPEUNION);
 	for (m = t->u.structunion.members; m; m = m->next) {
 		if (m->name) {
-			if (strcmp(m->name, name) == 0) {
+			if (m->name == name) {
 				*offset += m->offset;
 				return m;
 			}
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -142,3 +143,62 @@ listremove(struct list *list)
 	list->prev->next = list->next;
 	list->next = list->prev = NULL;
 }
+
+struct arenablock {
+	struct arenablock *next;
+	size_t size;
+	union {
+		long double f;
+		long long i;
+		void *p;
+	} data[];
+};
+
+void *
+arenaalloc(struct arena *a, size_t len)
+{
+	struct arenablock *b;
+	size_t size;
+	void *p;
+
+	len = ALIGNUP(len, sizeof(b->data[0]));
+	if (len > (size_t)(a->end - a->pos)) {
+		/* reuse the next block if it is large enough */
+		b = a->cur ? a->cur->next : a->head;
+		if (!b || b->size < len) {
+			size = len > 1<<16 ? len : 1<<16;
+			b = xmalloc(offsetof(struct arenablock, data) + size);
+			b->size = size;
+			if (a->cur) {
+				b->next = a->cur->next;
+				a->cur->next = b;
+			} else {
+				b->next = a->head;
+				a->head = b;
+			}
+		}
+		a->cur = b;
+		a->pos = (char *)b->data;
+		a->end = a->pos + b->size;
+	}
+	p = a->pos;
+	a->pos += len;
+
+	return p;
+}
+
+void
+arenareset(struct arena *a)
+{
+	a->cur = NULL;
+	a->pos = NULL;
+	a->end = NULL;
+}
+
+void
+arenarestore(struct arena *a, const struct arena *mark)
+{
+	a->cur = mark->cur;
+	a->pos = mark->pos;
+	a->end = mark->end;
+}
@@ -51,6 +51,19 @@ void arrayaddbuf(struct array *, const void *, size_t);
 void *arraylast(struct array *, size_t);
 #define arrayforeach(a, m) for (m = (a)->val; m != (void *)((char *)(a)->val + (a)->len); ++m)
 
+/* arena */
+
+struct arena {
+	struct arenablock *head, *cur;
+	char *pos, *end;
+};
+
+void *arenaalloc(struct arena *, size_t);
+/* release all allocations, keeping the memory for reuse */
+void arenareset(struct arena *);
+/* release the allocations made since the arena was saved in mark */
+void arenarestore(struct arena *, const struct arena *mark);
+
 /* map */
 
 struct map {
@@ -71,6 +84,12 @@ void mapfree(struct map *, void (*)(void *));
 void **mapput(struct map *, struct mapkey *);
 void *mapget(struct map *, struct mapkey *);
 
+/* return the unique copy of a string; its key is computed only once */
+char *intern(const char *, size_t);
+void atomkey(struct mapkey *, const char *);
+/* user data associated with an interned string, initially 0 */
+int *atomdata(const char *);
+
 /* tree */
 
 void *treeinsert(void **, unsigned long long, size_t);